@@ -0,0 +1,334 @@
+#ifndef REDBLACKCORE_H
+#define REDBLACKCORE_H
+
+#include "redblackengine.h"
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+// Header-only balancing engine without any Qt dependency, for code that needs the
+// ordered set but not the visualizer. Keys are unique, links are null based so trees
+// share no state and can be used from any thread, and every node keeps its subtree
+// size for Select and Rank in O(log n).
+//
+// Lookups with a key type other than Key need a transparent Compare, as in std::set.
+// The balancing itself is RedBlackEngine, which the Qt RedBlackTree runs on as well.
+template<typename Key, typename Compare = std::less<Key>>
+class RedBlackCore : private RedBlackSilentHooks
+{
+public:
+    enum class Color : unsigned char { RED, BLACK };
+
+    struct Node
+    {
+        Key key;
+        Node* left = nullptr;
+        Node* right = nullptr;
+        Node* parent = nullptr;
+        std::size_t size = 1;
+        Color color = Color::RED;
+
+        explicit Node(const Key& key) : key(key) {}
+        explicit Node(Key&& key) : key(std::move(key)) {}
+    };
+
+    RedBlackCore() = default;
+    explicit RedBlackCore(const Compare& compare) : compare(compare) {}
+    ~RedBlackCore() { Clear(); }
+
+    RedBlackCore(const RedBlackCore&) = delete;
+    RedBlackCore& operator=(const RedBlackCore&) = delete;
+
+    RedBlackCore(RedBlackCore&& other) noexcept
+        : root(std::exchange(other.root, nullptr)), compare(std::move(other.compare))
+    {}
+
+    RedBlackCore& operator=(RedBlackCore&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Clear();
+            root = std::exchange(other.root, nullptr);
+            compare = std::move(other.compare);
+        }
+        return *this;
+    }
+
+    const Node* GetRoot() const { return root; }
+    std::size_t Size() const { return SizeOf(root); }
+    bool IsEmpty() const { return root == nullptr; }
+
+    // Returns the node holding key and whether it was inserted by this call.
+    std::pair<Node*, bool> Insert(Key key);
+
+    bool Erase(const Key& key);
+    void Erase(const Node* node);
+
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const Node* Find(const K& key) const { return FindNode(key); }
+    const Node* Find(const Key& key) const { return FindNode(key); }
+
+    bool Contains(const Key& key) const { return FindNode(key) != nullptr; }
+
+    // Select is 0-based and returns null when k is out of range, Rank counts the keys
+    // smaller than key.
+    const Node* Select(std::size_t k) const;
+    std::size_t Rank(const Key& key) const;
+
+    static const Node* Minimum(const Node* node);
+    static const Node* Maximum(const Node* node);
+    static const Node* Next(const Node* node);
+    static const Node* Previous(const Node* node);
+
+    const Node* First() const { return Minimum(root); }
+    const Node* Last() const { return Maximum(root); }
+
+    void Clear();
+
+    // Checks key order, colors, black heights, sizes and parent links in O(n).
+    bool IsValid() const;
+
+private:
+    using Engine = RedBlackEngine<RedBlackCore, Node>;
+    friend Engine;
+
+    static std::size_t SizeOf(const Node* node) { return node ? node->size : 0; }
+    static bool IsRed(const Node* node) { return node && node->color == Color::RED; }
+    static bool IsNil(const Node* node) { return node == nullptr; }
+    static void PullUp(Node* node) { node->size = 1 + SizeOf(node->left) + SizeOf(node->right); }
+    static Node* Minimum(Node* node) { return const_cast<Node*>(Minimum(static_cast<const Node*>(node))); }
+
+    template<typename K>
+    const Node* FindNode(const K& key) const;
+
+    // Black height of the subtree or -1 when it breaks a rule.
+    int Validate(const Node* node, const Node* parent) const;
+
+    Node* root = nullptr;
+    Compare compare;
+};
+
+template<typename Key, typename Compare>
+std::pair<typename RedBlackCore<Key, Compare>::Node*, bool> RedBlackCore<Key, Compare>::Insert(Key key)
+{
+    Node* y = nullptr;
+    Node* x = root;
+    bool isLeft = true;
+
+    while (x)
+    {
+        y = x;
+        if (compare(key, x->key))
+        {
+            x = x->left;
+            isLeft = true;
+        }
+        else if (compare(x->key, key))
+        {
+            x = x->right;
+            isLeft = false;
+        }
+        else
+            return { x, false };
+    }
+
+    Node* z = new Node(std::move(key));
+    z->parent = y;
+
+    if (!y)
+        root = z;
+    else if (isLeft)
+        y->left = z;
+    else
+        y->right = z;
+
+    for (Node* node = y; node; node = node->parent)
+        ++node->size;
+
+    Engine::InsertFixup(*this, z);
+    return { z, true };
+}
+
+template<typename Key, typename Compare>
+bool RedBlackCore<Key, Compare>::Erase(const Key& key)
+{
+    const Node* node = FindNode(key);
+    if (!node)
+        return false;
+
+    Erase(node);
+    return true;
+}
+
+template<typename Key, typename Compare>
+void RedBlackCore<Key, Compare>::Erase(const Node* node)
+{
+    Node* z = const_cast<Node*>(node);
+    Engine::Unlink(*this, z);
+    delete z;
+}
+
+template<typename Key, typename Compare>
+template<typename K>
+const typename RedBlackCore<Key, Compare>::Node* RedBlackCore<Key, Compare>::FindNode(const K& key) const
+{
+    const Node* x = root;
+    while (x)
+    {
+        if (compare(key, x->key))
+            x = x->left;
+        else if (compare(x->key, key))
+            x = x->right;
+        else
+            return x;
+    }
+    return nullptr;
+}
+
+template<typename Key, typename Compare>
+const typename RedBlackCore<Key, Compare>::Node* RedBlackCore<Key, Compare>::Select(std::size_t k) const
+{
+    const Node* x = root;
+    while (x)
+    {
+        std::size_t leftSize = SizeOf(x->left);
+        if (k < leftSize)
+            x = x->left;
+        else if (k == leftSize)
+            return x;
+        else
+        {
+            k -= leftSize + 1;
+            x = x->right;
+        }
+    }
+    return nullptr;
+}
+
+template<typename Key, typename Compare>
+std::size_t RedBlackCore<Key, Compare>::Rank(const Key& key) const
+{
+    std::size_t rank = 0;
+    const Node* x = root;
+    while (x)
+    {
+        if (compare(x->key, key))
+        {
+            rank += SizeOf(x->left) + 1;
+            x = x->right;
+        }
+        else
+            x = x->left;
+    }
+    return rank;
+}
+
+template<typename Key, typename Compare>
+const typename RedBlackCore<Key, Compare>::Node* RedBlackCore<Key, Compare>::Minimum(const Node* node)
+{
+    if (node)
+    {
+        while (node->left)
+            node = node->left;
+    }
+    return node;
+}
+
+template<typename Key, typename Compare>
+const typename RedBlackCore<Key, Compare>::Node* RedBlackCore<Key, Compare>::Maximum(const Node* node)
+{
+    if (node)
+    {
+        while (node->right)
+            node = node->right;
+    }
+    return node;
+}
+
+template<typename Key, typename Compare>
+const typename RedBlackCore<Key, Compare>::Node* RedBlackCore<Key, Compare>::Next(const Node* node)
+{
+    if (node->right)
+        return Minimum(node->right);
+
+    const Node* parent = node->parent;
+    while (parent && node == parent->right)
+    {
+        node = parent;
+        parent = parent->parent;
+    }
+    return parent;
+}
+
+template<typename Key, typename Compare>
+const typename RedBlackCore<Key, Compare>::Node* RedBlackCore<Key, Compare>::Previous(const Node* node)
+{
+    if (node->left)
+        return Maximum(node->left);
+
+    const Node* parent = node->parent;
+    while (parent && node == parent->left)
+    {
+        node = parent;
+        parent = parent->parent;
+    }
+    return parent;
+}
+
+template<typename Key, typename Compare>
+void RedBlackCore<Key, Compare>::Clear()
+{
+    // Post-order walk that unlinks each leaf it deletes, so it needs no stack.
+    Node* node = root;
+    while (node)
+    {
+        if (node->left)
+            node = node->left;
+        else if (node->right)
+            node = node->right;
+        else
+        {
+            Node* parent = node->parent;
+            if (parent)
+                (parent->left == node ? parent->left : parent->right) = nullptr;
+            delete node;
+            node = parent;
+        }
+    }
+    root = nullptr;
+}
+
+template<typename Key, typename Compare>
+bool RedBlackCore<Key, Compare>::IsValid() const
+{
+    if (IsRed(root) || Validate(root, nullptr) < 0)
+        return false;
+
+    for (const Node* node = First(); node && Next(node); node = Next(node))
+    {
+        if (!compare(node->key, Next(node)->key))
+            return false;
+    }
+    return true;
+}
+
+template<typename Key, typename Compare>
+int RedBlackCore<Key, Compare>::Validate(const Node* node, const Node* parent) const
+{
+    if (!node)
+        return 0;
+
+    if (node->parent != parent || node->size != 1 + SizeOf(node->left) + SizeOf(node->right))
+        return -1;
+    if (IsRed(node) && (IsRed(node->left) || IsRed(node->right)))
+        return -1;
+
+    int left = Validate(node->left, node);
+    int right = Validate(node->right, node);
+    if (left < 0 || left != right)
+        return -1;
+
+    return left + (node->color == Color::BLACK ? 1 : 0);
+}
+
+#endif // REDBLACKCORE_H
@@ -0,0 +1,307 @@
+#ifndef REDBLACKENGINE_H
+#define REDBLACKENGINE_H
+
+#include <type_traits>
+#include <utility>
+
+// Rotations, fixups and unlinking shared by RedBlackCore and the Qt RedBlackTree, so
+// both run the same balancing code. Node needs left, right and parent links and a
+// color of an enum with RED and BLACK. Host owns the tree and provides
+//
+//   Node* root
+//   static bool IsNil(const Node*)  the empty child, null or a shared sentinel
+//   Node* Minimum(Node*)            smallest node of a non-empty subtree
+//   void PullUp(Node*)              recomputes the augmentations of a node from its children
+//
+// and the hooks of RedBlackSilentHooks. The hooks run before the change they announce,
+// so an observer still sees the old links. Hosts that don't watch the steps inherit
+// the silent ones. Nil children are only compared, never written.
+template<typename Host, typename Node>
+class RedBlackEngine
+{
+public:
+    using Color = std::decay_t<decltype(std::declval<Node&>().color)>;
+
+    // Rotates x down to the left or to the right, its child on the other side takes
+    // its place.
+    static void Rotate(Host& host, Node* x, bool isLeft);
+
+    // Replaces the subtree rooted at u with the one rooted at v.
+    static void Transplant(Host& host, Node* u, Node* v);
+
+    // Restores the rules after z was linked red.
+    static void InsertFixup(Host& host, Node* z);
+
+    // One step for a red z with a red parent and a black grandparent. Returns the node
+    // the violation moved up to, or a node with a black parent once it is resolved.
+    static Node* InsertFixupStep(Host& host, Node* z);
+
+    // Takes z out of the tree and rebalances, z itself is left to the caller.
+    static void Unlink(Host& host, Node* z);
+
+    // Restores the black heights after a black node left the tree. x may be nil, so
+    // its parent is passed in xp.
+    static void DeleteFixup(Host& host, Node* x, Node* xp);
+
+private:
+    static bool IsRed(const Node* node) { return !Host::IsNil(node) && node->color == Color::RED; }
+    static Node*& Child(Node* node, bool isLeft) { return isLeft ? node->left : node->right; }
+
+    static void Recolor(Host& host, Node* node, Color color)
+    {
+        host.OnRecolor(node, color);
+        node->color = color;
+    }
+};
+
+// No-op hooks of RedBlackEngine.
+struct RedBlackSilentHooks
+{
+    template<typename Node, typename Color>
+    void OnRecolor(Node*, Color) {}
+
+    // A rotation of x with its child y starts.
+    template<typename Node>
+    void OnRotate(Node*, Node*, bool) {}
+
+    // y moves up to x's place under to, the root when isRoot is set.
+    template<typename Node>
+    void OnRaise(Node*, Node*, bool, bool, bool) {}
+
+    // x moves down below y.
+    template<typename Node>
+    void OnLower(Node*, Node*, bool) {}
+
+    template<typename Node>
+    void OnRotated(Node*, bool) {}
+
+    template<typename Node>
+    void OnSetParent(Node*, Node*) {}
+
+    template<typename Node>
+    void OnSetChild(Node*, Node*, bool) {}
+
+    // v takes the place of a subtree under to, the root when isRoot is set.
+    template<typename Node>
+    void OnTransplant(Node*, Node*, bool, bool) {}
+
+    // z has left the tree, the sizes above it are not recounted yet.
+    template<typename Node>
+    void OnUnlink(Node*) {}
+};
+
+template<typename Host, typename Node>
+void RedBlackEngine<Host, Node>::Rotate(Host& host, Node* x, bool isLeft)
+{
+    Node* y = Child(x, !isLeft);
+
+    host.OnRotate(x, y, isLeft);
+    Child(x, !isLeft) = Child(y, isLeft);
+
+    if (!Host::IsNil(Child(y, isLeft)))
+    {
+        host.OnSetParent(Child(y, isLeft), x);
+        Child(y, isLeft)->parent = x;
+    }
+
+    host.OnSetParent(y, x->parent);
+    y->parent = x->parent;
+
+    Node* xp = x->parent;
+    if (Host::IsNil(xp))
+    {
+        host.OnRaise(y, host.root, true, isLeft, true);
+        host.root = y;
+    }
+    else if (x == xp->left)
+    {
+        host.OnRaise(y, xp, true, isLeft, false);
+        xp->left = y;
+    }
+    else
+    {
+        host.OnRaise(y, xp, false, isLeft, false);
+        xp->right = y;
+    }
+
+    host.OnLower(x, y, isLeft);
+    host.OnSetParent(x, y);
+
+    Child(y, isLeft) = x;
+    x->parent = y;
+
+    host.PullUp(x);
+    host.PullUp(y);
+
+    host.OnRotated(x, isLeft);
+}
+
+template<typename Host, typename Node>
+void RedBlackEngine<Host, Node>::Transplant(Host& host, Node* u, Node* v)
+{
+    Node* up = u->parent;
+    if (Host::IsNil(up))
+    {
+        host.OnTransplant(v, host.root, true, true);
+        host.root = v;
+    }
+    else if (u == up->left)
+    {
+        host.OnTransplant(v, up, true, false);
+        up->left = v;
+    }
+    else
+    {
+        host.OnTransplant(v, up, false, false);
+        up->right = v;
+    }
+
+    if (!Host::IsNil(v))
+    {
+        host.OnSetParent(v, up);
+        v->parent = up;
+    }
+}
+
+template<typename Host, typename Node>
+void RedBlackEngine<Host, Node>::InsertFixup(Host& host, Node* z)
+{
+    while (IsRed(z->parent))
+        z = InsertFixupStep(host, z);
+
+    Recolor(host, host.root, Color::BLACK);
+}
+
+template<typename Host, typename Node>
+Node* RedBlackEngine<Host, Node>::InsertFixupStep(Host& host, Node* z)
+{
+    Node* zp = z->parent;
+    Node* zpp = zp->parent;
+    bool isLeft = zp == zpp->left;
+    Node* uncle = Child(zpp, !isLeft);
+
+    if (IsRed(uncle))
+    {
+        Recolor(host, zp, Color::BLACK);
+        Recolor(host, uncle, Color::BLACK);
+        Recolor(host, zpp, Color::RED);
+        return zpp;
+    }
+
+    if (z == Child(zp, !isLeft))
+    {
+        z = zp;
+        Rotate(host, z, isLeft);
+        zp = z->parent;
+    }
+
+    Recolor(host, zp, Color::BLACK);
+    Recolor(host, zpp, Color::RED);
+    Rotate(host, zpp, !isLeft);
+    return z;
+}
+
+template<typename Host, typename Node>
+void RedBlackEngine<Host, Node>::Unlink(Host& host, Node* z)
+{
+    Node* y = z;
+    Node* x;
+    Node* xp;
+    Color yOriginalColor = y->color;
+
+    if (Host::IsNil(z->left))
+    {
+        x = z->right;
+        xp = z->parent;
+        Transplant(host, z, z->right);
+    }
+    else if (Host::IsNil(z->right))
+    {
+        x = z->left;
+        xp = z->parent;
+        Transplant(host, z, z->left);
+    }
+    else
+    {
+        y = host.Minimum(z->right);
+        yOriginalColor = y->color;
+        x = y->right;
+
+        if (y != z->right)
+        {
+            xp = y->parent;
+            Transplant(host, y, y->right);
+
+            host.OnSetChild(y, z->right, false);
+            host.OnSetParent(y->right, y);
+
+            y->right = z->right;
+            y->right->parent = y;
+        }
+        else
+            xp = y;
+
+        Transplant(host, z, y);
+
+        host.OnSetChild(y, z->left, true);
+        host.OnSetParent(y->left, y);
+
+        y->left = z->left;
+        y->left->parent = y;
+        Recolor(host, y, z->color);
+    }
+
+    host.OnUnlink(z);
+
+    // Everything below xp kept its size, the spliced path up to the root lost one node.
+    for (Node* node = xp; !Host::IsNil(node); node = node->parent)
+        host.PullUp(node);
+
+    if (yOriginalColor == Color::BLACK)
+        DeleteFixup(host, x, xp);
+}
+
+template<typename Host, typename Node>
+void RedBlackEngine<Host, Node>::DeleteFixup(Host& host, Node* x, Node* xp)
+{
+    while (x != host.root && !IsRed(x))
+    {
+        bool isLeft = x == xp->left;
+        Node* w = Child(xp, !isLeft);
+
+        if (IsRed(w))
+        {
+            Recolor(host, w, Color::BLACK);
+            Recolor(host, xp, Color::RED);
+            Rotate(host, xp, isLeft);
+            w = Child(xp, !isLeft);
+        }
+
+        if (!IsRed(w->left) && !IsRed(w->right))
+        {
+            Recolor(host, w, Color::RED);
+            x = xp;
+            xp = x->parent;
+            continue;
+        }
+
+        if (!IsRed(Child(w, !isLeft)))
+        {
+            Recolor(host, Child(w, isLeft), Color::BLACK);
+            Recolor(host, w, Color::RED);
+            Rotate(host, w, !isLeft);
+            w = Child(xp, !isLeft);
+        }
+
+        Recolor(host, w, xp->color);
+        Recolor(host, xp, Color::BLACK);
+        Recolor(host, Child(w, !isLeft), Color::BLACK);
+        Rotate(host, xp, isLeft);
+        x = host.root;
+    }
+
+    if (!Host::IsNil(x))
+        Recolor(host, x, Color::BLACK);
+}
+
+#endif // REDBLACKENGINE_H
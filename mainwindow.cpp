@@ -50,21 +50,21 @@ MainWindow::MainWindow(QWidget *parent)
     connect(ui->deleteLineEdit, &QLineEdit::returnPressed, ui->deleteButton, &QPushButton::click);
     connect(ui->findLineEdit, &QLineEdit::returnPressed, ui->findButton, &QPushButton::click);
 
-    connect(&redBlackTree, SIGNAL(HighlightNodeSignal(std::shared_ptr<Node>,QColor,bool,QString)), this, SLOT(On_HighlightNode(std::shared_ptr<Node>,QColor,bool,QString)));
-    connect(&redBlackTree, SIGNAL(ChangeColorSignal(std::shared_ptr<Node>,Color)), this, SLOT(On_ChangeColor(std::shared_ptr<Node>,Color)));
-    connect(&redBlackTree, SIGNAL(CreateNodeSignal(std::shared_ptr<Node>)), this, SLOT(On_CreateNode(std::shared_ptr<Node>)));
-    connect(&redBlackTree, SIGNAL(MoveNodeSignal(std::shared_ptr<Node>,std::shared_ptr<Node>,bool,bool)), this, SLOT(On_MoveNode(std::shared_ptr<Node>,std::shared_ptr<Node>,bool,bool)));
-
-    connect(&redBlackTree, SIGNAL(MoveYSignal(std::shared_ptr<Node>,std::shared_ptr<Node>,bool,bool,bool)), this, SLOT(On_MoveY(std::shared_ptr<Node>,std::shared_ptr<Node>,bool,bool,bool)));
-    connect(&redBlackTree, SIGNAL(MoveXSignal(std::shared_ptr<Node>,std::shared_ptr<Node>,bool)), this, SLOT(On_MoveX(std::shared_ptr<Node>,std::shared_ptr<Node>,bool)));
-    connect(&redBlackTree, SIGNAL(MoveStartSignal(std::shared_ptr<Node>,std::shared_ptr<Node>,bool,bool)), this, SLOT(On_MoveStart(std::shared_ptr<Node>,std::shared_ptr<Node>,bool,bool)));
-    connect(&redBlackTree, SIGNAL(ChangeParentSignal(std::shared_ptr<Node>,std::shared_ptr<Node>)), this, SLOT(On_ChangeParent(std::shared_ptr<Node>,std::shared_ptr<Node>)));
-    connect(&redBlackTree, SIGNAL(LeftRotateSignal(std::shared_ptr<Node>)), this, SLOT(On_LeftRotate(std::shared_ptr<Node>)));
-    connect(&redBlackTree, SIGNAL(RightRotateSignal(std::shared_ptr<Node>)), this, SLOT(On_RightRotate(std::shared_ptr<Node>)));
-
-    connect(&redBlackTree, SIGNAL(TransplantSignal(std::shared_ptr<Node>,std::shared_ptr<Node>,bool,bool)), this, SLOT(On_Transplant(std::shared_ptr<Node>,std::shared_ptr<Node>,bool,bool)));
-    connect(&redBlackTree, SIGNAL(DeleteSignal(std::shared_ptr<Node>)), this, SLOT(On_Delete(std::shared_ptr<Node>)));
-    connect(&redBlackTree, SIGNAL(ChangeSiblingSignal(std::shared_ptr<Node>,std::shared_ptr<Node>,bool)), this, SLOT(On_ChangeSiblingSignal(std::shared_ptr<Node>,std::shared_ptr<Node>,bool)));
+    connect(&redBlackTree, SIGNAL(HighlightNodeSignal(Node*,QColor,bool,QString)), this, SLOT(On_HighlightNode(Node*,QColor,bool,QString)));
+    connect(&redBlackTree, SIGNAL(ChangeColorSignal(Node*,Color)), this, SLOT(On_ChangeColor(Node*,Color)));
+    connect(&redBlackTree, SIGNAL(CreateNodeSignal(Node*)), this, SLOT(On_CreateNode(Node*)));
+    connect(&redBlackTree, SIGNAL(MoveNodeSignal(Node*,Node*,bool,bool)), this, SLOT(On_MoveNode(Node*,Node*,bool,bool)));
+
+    connect(&redBlackTree, SIGNAL(MoveYSignal(Node*,Node*,bool,bool,bool)), this, SLOT(On_MoveY(Node*,Node*,bool,bool,bool)));
+    connect(&redBlackTree, SIGNAL(MoveXSignal(Node*,Node*,bool)), this, SLOT(On_MoveX(Node*,Node*,bool)));
+    connect(&redBlackTree, SIGNAL(MoveStartSignal(Node*,Node*,bool,bool)), this, SLOT(On_MoveStart(Node*,Node*,bool,bool)));
+    connect(&redBlackTree, SIGNAL(ChangeParentSignal(Node*,Node*)), this, SLOT(On_ChangeParent(Node*,Node*)));
+    connect(&redBlackTree, SIGNAL(LeftRotateSignal(Node*)), this, SLOT(On_LeftRotate(Node*)));
+    connect(&redBlackTree, SIGNAL(RightRotateSignal(Node*)), this, SLOT(On_RightRotate(Node*)));
+
+    connect(&redBlackTree, SIGNAL(TransplantSignal(Node*,Node*,bool,bool)), this, SLOT(On_Transplant(Node*,Node*,bool,bool)));
+    connect(&redBlackTree, SIGNAL(DeleteSignal(Node*)), this, SLOT(On_Delete(Node*)));
+    connect(&redBlackTree, SIGNAL(ChangeSiblingSignal(Node*,Node*,bool)), this, SLOT(On_ChangeSiblingSignal(Node*,Node*,bool)));
 }
 
 
@@ -91,7 +91,7 @@ void MainWindow::CreateMenus()
     menu->addAction(exportAction);
 }
 
-void MainWindow::Draw(quint16 height)
+void MainWindow::Draw(quint32 height)
 {
     delete scene;
     scene = new QGraphicsScene(ui->graphicsView);
@@ -178,7 +178,7 @@ void MainWindow::DrawTree(QGraphicsScene* scene, TreeNode *treeNode, int treeHei
 }
 
 
-void MainWindow::MakeTree(TreeNode*& treeNode, std::shared_ptr<Node> node)
+void MainWindow::MakeTree(TreeNode*& treeNode, Node* node)
 {
     if (node == NIL)
         return;
@@ -225,7 +225,7 @@ void MainWindow::On_Import()
 {
     QString fileName = QFileDialog::getOpenFileName(this, "Open file for import",
                                                     QStandardPaths::writableLocation(QStandardPaths::DesktopLocation),
-                                                    "Text files (*.txt);;JSON files (*.json);;XML files (*.xml);;Binary files (*.bin *.dat)");
+                                                    "Text files (*.txt);;JSON files (*.json);;XML files (*.xml);;Binary files (*.bin *.dat);;Key lists (*.keys)");
 
     if (!redBlackTree.ImportTree(fileName))
         return;
@@ -252,7 +252,7 @@ void MainWindow::On_Export()
 {
     QString fileName = QFileDialog::getSaveFileName(this, "Export tree to file",
                                                     QStandardPaths::writableLocation(QStandardPaths::DesktopLocation),
-                                                    "Text files (*.txt);;JSON files (*.json);;XML files (*.xml);;Binary files (*.bin *.dat)");
+                                                    "Text files (*.txt);;JSON files (*.json);;XML files (*.xml);;Binary files (*.bin *.dat);;Key lists (*.keys)");
 
     if (!redBlackTree.ExportTree(fileName))
         return;
@@ -442,6 +442,9 @@ void MainWindow::ConfigureLineEdits()
     case DataType::CHAR:
         regExp.setPattern(".");
         break;
+    case DataType::INTERVAL:
+        regExp.setPattern("^\\[?-?\\d{0,4}(,-?\\d{0,4}\\]?)?$");
+        break;
     }
 
     ui->insertLineEdit->setValidator(new QRegularExpressionValidator(regExp));
@@ -612,7 +615,7 @@ void MainWindow::On_ForwardButtonClicked()
     }
 }
 
-void MainWindow::On_HighlightNode(std::shared_ptr<Node> node, QColor color, bool isLeft, const QString& key)
+void MainWindow::On_HighlightNode(Node* node, QColor color, bool isLeft, const QString& key)
 {
     if (node == NIL)
         return;
@@ -661,7 +664,7 @@ void MainWindow::On_HighlightNode(std::shared_ptr<Node> node, QColor color, bool
     seqGroup->addAnimation(group);
 }
 
-void MainWindow::On_ChangeColor(std::shared_ptr<Node> node, Color color)
+void MainWindow::On_ChangeColor(Node* node, Color color)
 {
     int duration = 2000;
     //TreeNode* treeNode = nodeMap[node];
@@ -685,7 +688,7 @@ void MainWindow::On_ChangeColor(std::shared_ptr<Node> node, Color color)
     seqGroup->addAnimation(colorAnimation);
 }
 
-void MainWindow::On_CreateNode(std::shared_ptr<Node> node)
+void MainWindow::On_CreateNode(Node* node)
 {
     TreeNode* newNode = new TreeNode(node->GetDataString(), 1, Color::RED);
     connect(this, SIGNAL(ShowBlackHeightSignal(bool)), newNode, SLOT(On_ShowBlackHeight(bool)));
@@ -696,7 +699,7 @@ void MainWindow::On_CreateNode(std::shared_ptr<Node> node)
     scene->update();
 }
 
-void MainWindow::On_MoveNode(std::shared_ptr<Node> node, std::shared_ptr<Node> to, bool leftChild, bool isRoot)
+void MainWindow::On_MoveNode(Node* node, Node* to, bool leftChild, bool isRoot)
 {
     int duration = 5000;
 
@@ -765,7 +768,7 @@ void MainWindow::On_MoveNode(std::shared_ptr<Node> node, std::shared_ptr<Node> t
     seqGroup->addAnimation(moveAnimation);
 }
 
-void MainWindow::On_MoveY(std::shared_ptr<Node> node, std::shared_ptr<Node> to, bool leftChild, bool isLeftRotate, bool isRoot)
+void MainWindow::On_MoveY(Node* node, Node* to, bool leftChild, bool isLeftRotate, bool isRoot)
 {
     int duration = 5000;
 
@@ -854,7 +857,7 @@ void MainWindow::On_MoveY(std::shared_ptr<Node> node, std::shared_ptr<Node> to,
     }
 }
 
-void MainWindow::On_MoveX(std::shared_ptr<Node> node, std::shared_ptr<Node> to, bool leftChild)
+void MainWindow::On_MoveX(Node* node, Node* to, bool leftChild)
 {
     int duration = 5000;
 
@@ -916,7 +919,7 @@ void MainWindow::On_MoveX(std::shared_ptr<Node> node, std::shared_ptr<Node> to,
 
 }
 
-void MainWindow::On_MoveStart(std::shared_ptr<Node> x, std::shared_ptr<Node> y, bool x_leftChild, bool y_leftChild)
+void MainWindow::On_MoveStart(Node* x, Node* y, bool x_leftChild, bool y_leftChild)
 {
     int duration = 5000;
 
@@ -976,13 +979,13 @@ void MainWindow::On_MoveStart(std::shared_ptr<Node> x, std::shared_ptr<Node> y,
 
 }
 
-void MainWindow::On_ChangeParent(std::shared_ptr<Node> x, std::shared_ptr<Node> y)
+void MainWindow::On_ChangeParent(Node* x, Node* y)
 {
     if (nodeMap[x])
         nodeMap[x]->parent = nodeMap[y];
 }
 
-void MainWindow::On_LeftRotate(std::shared_ptr<Node> x)
+void MainWindow::On_LeftRotate(Node* x)
 {
     QParallelAnimationGroup* group = new QParallelAnimationGroup;
     connect(group, &QParallelAnimationGroup::stateChanged, this, [this, group] {
@@ -999,7 +1002,7 @@ void MainWindow::On_LeftRotate(std::shared_ptr<Node> x)
     seqGroup->addAnimation(group);
 }
 
-void MainWindow::On_RightRotate(std::shared_ptr<Node> x)
+void MainWindow::On_RightRotate(Node* x)
 {
     QParallelAnimationGroup* group = new QParallelAnimationGroup;
     connect(group, &QParallelAnimationGroup::stateChanged, this, [this, group] {
@@ -1016,7 +1019,7 @@ void MainWindow::On_RightRotate(std::shared_ptr<Node> x)
     seqGroup->addAnimation(group);
 }
 
-void MainWindow::On_Transplant(std::shared_ptr<Node> node, std::shared_ptr<Node> to, bool leftChild, bool isRoot)
+void MainWindow::On_Transplant(Node* node, Node* to, bool leftChild, bool isRoot)
 {
     int duration = 5000;
 
@@ -1071,7 +1074,7 @@ void MainWindow::On_Transplant(std::shared_ptr<Node> node, std::shared_ptr<Node>
     transplantAnims.append(moveAnimation);
 }
 
-void MainWindow::On_Delete(std::shared_ptr<Node> node)
+void MainWindow::On_Delete(Node* node)
 {
     QParallelAnimationGroup* group = new QParallelAnimationGroup;
 
@@ -1103,7 +1106,7 @@ void MainWindow::On_Delete(std::shared_ptr<Node> node)
     seqGroup->addAnimation(group);
 }
 
-void MainWindow::On_ChangeSiblingSignal(std::shared_ptr<Node> node, std::shared_ptr<Node> to, bool leftChild)
+void MainWindow::On_ChangeSiblingSignal(Node* node, Node* to, bool leftChild)
 {
     if (nodeMap[node])
     {
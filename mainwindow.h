@@ -49,18 +49,18 @@ private:
 
     QList<NilNode*> nilNodes;
 
-    quint16 newNodeHeight = 0;
-    QMap<std::shared_ptr<Node>, TreeNode*> nodeMap;
+    quint32 newNodeHeight = 0;
+    QMap<Node*, TreeNode*> nodeMap;
     QList<QPropertyAnimation*> leftRotateAnims, rightRotateAnims, transplantAnims;
 private:
     void CreateMenus();
     void ConfigureLineEdits();
     void ShowPropertiesDialog();
 
-    void Draw(quint16 height);
+    void Draw(quint32 height);
     void DrawTree(QGraphicsScene* scene, TreeNode* treeNode, int treeHeight);
 
-    void MakeTree(TreeNode *&treeNode, std::shared_ptr<Node> node);
+    void MakeTree(TreeNode *&treeNode, Node* node);
 
 protected:
     void keyPressEvent(QKeyEvent *event) override;
@@ -89,21 +89,21 @@ private slots:
     void On_PlayButtonClicked();
     void On_ForwardButtonClicked();
 
-    void On_HighlightNode(std::shared_ptr<Node> node, QColor color, bool isLeft, const QString& key);
-    void On_ChangeColor(std::shared_ptr<Node> node, Color color);
-    void On_CreateNode(std::shared_ptr<Node> node);
-    void On_MoveNode(std::shared_ptr<Node> node, std::shared_ptr<Node> to, bool leftChild, bool isRoot = false);
-
-    void On_MoveY(std::shared_ptr<Node> node, std::shared_ptr<Node> to, bool leftChild, bool isLeftRotate, bool isRoot = false);
-    void On_MoveX(std::shared_ptr<Node> node, std::shared_ptr<Node> to, bool leftChild);
-    void On_MoveStart(std::shared_ptr<Node> x, std::shared_ptr<Node> y, bool x_leftChild, bool y_leftChild);
-    void On_ChangeParent(std::shared_ptr<Node> x, std::shared_ptr<Node> y);
-    void On_LeftRotate(std::shared_ptr<Node> x);
-    void On_RightRotate(std::shared_ptr<Node> x);
-
-    void On_Transplant(std::shared_ptr<Node> node, std::shared_ptr<Node> to, bool leftChild, bool isRoot = false);
-    void On_Delete(std::shared_ptr<Node> node);
-    void On_ChangeSiblingSignal(std::shared_ptr<Node> node, std::shared_ptr<Node> to, bool leftChild);
+    void On_HighlightNode(Node* node, QColor color, bool isLeft, const QString& key);
+    void On_ChangeColor(Node* node, Color color);
+    void On_CreateNode(Node* node);
+    void On_MoveNode(Node* node, Node* to, bool leftChild, bool isRoot = false);
+
+    void On_MoveY(Node* node, Node* to, bool leftChild, bool isLeftRotate, bool isRoot = false);
+    void On_MoveX(Node* node, Node* to, bool leftChild);
+    void On_MoveStart(Node* x, Node* y, bool x_leftChild, bool y_leftChild);
+    void On_ChangeParent(Node* x, Node* y);
+    void On_LeftRotate(Node* x);
+    void On_RightRotate(Node* x);
+
+    void On_Transplant(Node* node, Node* to, bool leftChild, bool isRoot = false);
+    void On_Delete(Node* node);
+    void On_ChangeSiblingSignal(Node* node, Node* to, bool leftChild);
 
 signals:
     void ShowBlackHeightSignal(bool);
@@ -1,14 +1,16 @@
 #include "node.h"
+#include <limits>
 
-const std::shared_ptr<Node> NIL = std::make_shared<Node>(std::variant<qint16, QString, QChar>{}, Color::BLACK);
+static Node nilNode(NodeData{}, Color::BLACK, 0);
+Node* const NIL = &nilNode;
 
 qint16 Node::CalculateBlackHeight(const Node* node) const
 {
-    if (node == NIL.get())
+    if (node == NIL)
         return 0;
 
-    qint16 leftBlackHeight = CalculateBlackHeight(node->left.get()) + (node->left->color == Color::BLACK ? 1 : 0);
-    qint16 rightBlackHeight = CalculateBlackHeight(node->right.get()) + (node->right->color == Color::BLACK ? 1 : 0);
+    qint16 leftBlackHeight = CalculateBlackHeight(node->left) + (node->left->color == Color::BLACK ? 1 : 0);
+    qint16 rightBlackHeight = CalculateBlackHeight(node->right) + (node->right->color == Color::BLACK ? 1 : 0);
 
     if (leftBlackHeight != rightBlackHeight)
         return -1;
@@ -21,3 +23,29 @@ qint16 Node::GetBlackHeight() const
     return CalculateBlackHeight(this);
 }
 
+
+qint64 Aggregate::KeyValue(const Node& node)
+{
+    if (auto number = std::get_if<qint16>(&node.data))
+        return *number;
+    if (auto character = std::get_if<QChar>(&node.data))
+        return character->unicode();
+    if (auto interval = std::get_if<Interval>(&node.data))
+        return interval->high - interval->low;
+    return std::get<QString>(node.data).length();
+}
+
+Aggregate Aggregate::Sum(std::function<qint64(const Node&)> map)
+{
+    return { 0, std::move(map), [](qint64 a, qint64 b) { return a + b; } };
+}
+
+Aggregate Aggregate::Min(std::function<qint64(const Node&)> map)
+{
+    return { std::numeric_limits<qint64>::max(), std::move(map), [](qint64 a, qint64 b) { return std::min(a, b); } };
+}
+
+Aggregate Aggregate::Max(std::function<qint64(const Node&)> map)
+{
+    return { std::numeric_limits<qint64>::min(), std::move(map), [](qint64 a, qint64 b) { return std::max(a, b); } };
+}
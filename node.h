@@ -2,12 +2,30 @@
 #define NODE_H
 
 #include <QString>
+#include <QVariant>
+#include <QHash>
+#include <functional>
+#include <memory>
 
 static constexpr qint16 UPPER_BOUND = 10000;
 static constexpr qint16 LOWER_BOUND = -10000;
 static constexpr qsizetype MAX_LENGTH = 4;
 
-enum class Color { RED, BLACK };
+enum class Color : quint8 { RED, BLACK };
+
+// Closed interval [low, high], ordered by low endpoint and then by high endpoint.
+struct Interval
+{
+    qint16 low, high;
+
+    bool operator==(const Interval& other) const { return low == other.low && high == other.high; }
+    bool operator<(const Interval& other) const
+    {
+        return low < other.low || (low == other.low && high < other.high);
+    }
+
+    bool Overlaps(const Interval& other) const { return low <= other.high && other.low <= high; }
+};
 
 template<typename T>
 QString ConvertToString(const T& value);
@@ -30,38 +48,111 @@ inline QString ConvertToString<QChar>(const QChar& value)
     return QString(value);
 }
 
-struct DataComparer
+template<>
+inline QString ConvertToString<Interval>(const Interval& value)
+{
+    return QString("[%1,%2]").arg(value.low).arg(value.high);
+}
+
+using NodeData = std::variant<qint16, QString, QChar, Interval>;
+
+inline size_t qHash(const Interval& interval, size_t seed = 0)
+{
+    return qHashMulti(seed, interval.low, interval.high);
+}
+
+// Consistent with operator== of NodeData, which the exact-match lookups use.
+inline size_t qHash(const NodeData& data, size_t seed = 0)
+{
+    return std::visit([seed](const auto& value) { return qHash(value, seed); }, data);
+}
+
+// Strict weak ordering used by the typed tree operations. The generic version covers
+// numbers, the specializations keep the locale-aware ordering of text and characters.
+template<typename T>
+struct KeyCompare
+{
+    bool operator()(const T& a, const T& b) const
+    {
+        return a < b;
+    }
+};
+
+// Transparent, QString converts to QStringView without a copy so stored keys can be
+// compared with views directly.
+template<>
+struct KeyCompare<QString>
 {
-    bool operator()(const QString& s1, const QString& s2) const
+    using is_transparent = void;
+
+    bool operator()(QStringView s1, QStringView s2) const
     {
         return QString::localeAwareCompare(s1, s2) < 0;
     }
+};
 
+template<>
+struct KeyCompare<QChar>
+{
     bool operator()(const QChar& c1, const QChar& c2) const
     {
-        return QString::localeAwareCompare(c1, c2) < 0;
+        return QString::localeAwareCompare(QStringView(&c1, 1), QStringView(&c2, 1)) < 0;
     }
+};
 
-    template <class T, class U>
-    bool operator()(const T& a, const U& b) const
+// Treats "not greater" as "less", splitting with it sends keys equal to the split key
+// to the lower part.
+template<typename T, typename Compare = KeyCompare<T>>
+struct KeyNotGreater
+{
+    bool operator()(const T& a, const T& b) const
     {
-        return a < b;
+        return !Compare()(b, a);
     }
 };
 
 struct Node
 {
-    std::variant<qint16, QString, QChar> data;
+    NodeData data;
+    // Links are non-owning, the tree that contains the node is responsible for deleting it.
+    Node* left, *right, *parent;
+    // Number of live nodes in the subtree rooted here, NIL has size 0.
+    quint64 size;
+    // Summary of the subtree under the tree's Aggregate, unused while none is set.
+    qint64 aggregate;
+    // Copies of the key held by this node, only a multiset tree raises it above 1. A
+    // lazily deleted node keeps its place in the tree as a tombstone with a count of 0.
+    quint32 count;
+    // Largest high endpoint in the subtree of an interval tree.
+    qint16 maxHigh;
     Color color;
-    std::shared_ptr<Node> left, right;
-    std::weak_ptr<Node> parent;
+    // Payload of a RedBlackMap entry. It is allocated on first use, so nodes of plain
+    // trees only carry the null pointer.
+    std::unique_ptr<QVariant> value;
 
-    Node(const std::variant<qint16, QString, QChar>& data, Color color)
-        : data(data), color(color), left(nullptr), right(nullptr)
+    Node(const NodeData& data, Color color, quint64 size = 1)
+        : data(data), left(nullptr), right(nullptr), parent(nullptr), size(size), aggregate(0), count(1),
+          maxHigh(std::holds_alternative<Interval>(data) ? std::get<Interval>(data).high : 0), color(color)
     {}
 
     QChar GetColorChar() const { return color == Color::BLACK ? 'B' : 'R'; }
 
+    // The stored payload or an invalid QVariant while there is none.
+    const QVariant& GetPayload() const
+    {
+        static const QVariant none;
+        return value ? *value : none;
+    }
+
+    // Allocates the payload if the node has none yet.
+    QVariant& EnsurePayload()
+    {
+        if (!value)
+            value = std::make_unique<QVariant>();
+        return *value;
+    }
+    bool IsTombstone() const { return count == 0; }
+
     QString GetDataString() const
     {
         return std::visit([](auto&& arg) {
@@ -72,13 +163,33 @@ struct Node
     qint16 CalculateBlackHeight(const Node* node) const;
     qint16 GetBlackHeight() const;
 
-    bool CompareData(const std::variant<qint16, QString, QChar> &data) const
-    {
-        return std::visit(DataComparer{}, this->data, data);
-    }
-
+    // Unchecked access to the key, the tree guarantees every node holds its data type.
+    template<typename T>
+    const T& GetData() const { return *std::get_if<T>(&data); }
 };
 
-extern const std::shared_ptr<Node> NIL;
+// Shared leaf sentinel of every tree. It is read-only: trees in different threads use
+// it concurrently, and nodes keep pointing to it when Join and Split move them between
+// trees, so no operation may write its parent, color or links.
+extern Node* const NIL;
+
+// Associative summary kept for every subtree. Map turns a single node into a value,
+// combine has to be associative with identity as its neutral element. Values are
+// combined in key order, so combine does not need to be commutative.
+struct Aggregate
+{
+    qint64 identity = 0;
+    std::function<qint64(const Node&)> map;
+    std::function<qint64(qint64, qint64)> combine;
+
+    bool IsSet() const { return static_cast<bool>(combine); }
+
+    // Numbers contribute their value, characters their code point, text and intervals their length.
+    static qint64 KeyValue(const Node& node);
+
+    static Aggregate Sum(std::function<qint64(const Node&)> map = KeyValue);
+    static Aggregate Min(std::function<qint64(const Node&)> map = KeyValue);
+    static Aggregate Max(std::function<qint64(const Node&)> map = KeyValue);
+};
 
 #endif // NODE_H
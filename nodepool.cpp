@@ -0,0 +1,141 @@
+#include "nodepool.h"
+#include <algorithm>
+
+void* NodePool::Allocate()
+{
+    if (freeList)
+    {
+        Slot* slot = freeList;
+        freeList = slot->next;
+        if (!freeList)
+            freeTail = nullptr;
+        --freeNodes;
+        return slot;
+    }
+
+    if (cursor == cursorEnd)
+        AddSlab(lastSlabSize == 0 ? MIN_SLAB_SIZE : std::min(lastSlabSize * 2, MAX_SLAB_SIZE));
+
+    return cursor++;
+}
+
+void NodePool::AddSlab(std::size_t size)
+{
+    // Slots the current slab never handed out stay usable through the free list.
+    for (; cursor != cursorEnd; ++cursor)
+        PushFree(cursor);
+
+    slabs.push_back({ std::shared_ptr<Slot[]>(new Slot[size]), size });
+    lastSlabSize = size;
+
+    cursor = slabs.back().memory.get();
+    cursorEnd = cursor + size;
+    capacity += size;
+}
+
+void NodePool::Destroy(Node* node)
+{
+    if (node == nullptr || node == NIL)
+        return;
+
+    node->~Node();
+
+    PushFree(reinterpret_cast<Slot*>(node));
+    --liveNodes;
+}
+
+void NodePool::PushFree(Slot* slot)
+{
+    slot->next = freeList;
+    freeList = slot;
+    if (!freeTail)
+        freeTail = slot;
+    ++freeNodes;
+}
+
+void NodePool::Release()
+{
+    slabs.clear();
+    lastSlabSize = 0;
+
+    freeList = freeTail = nullptr;
+    cursor = cursorEnd = nullptr;
+
+    capacity = liveNodes = freeNodes = 0;
+}
+
+void NodePool::Reserve(std::size_t nodeCount)
+{
+    std::size_t available = freeNodes + static_cast<std::size_t>(cursorEnd - cursor);
+
+    if (nodeCount > available)
+        AddSlab(std::max(nodeCount - available, MIN_SLAB_SIZE));
+}
+
+NodePool::Statistics NodePool::GetStatistics() const
+{
+    Statistics stats;
+    stats.slabCount = slabs.size();
+    stats.capacity = capacity;
+    stats.liveNodes = liveNodes;
+    stats.freeNodes = freeNodes;
+    stats.totalAllocations = totalAllocations;
+    stats.reservedBytes = capacity * sizeof(Slot);
+    return stats;
+}
+
+void NodePool::Absorb(NodePool& other)
+{
+    if (&other == this)
+        return;
+
+    // Only one never used range can stay behind the cursor, the shorter one becomes
+    // ordinary free slots.
+    if (other.cursorEnd - other.cursor > cursorEnd - cursor)
+    {
+        std::swap(cursor, other.cursor);
+        std::swap(cursorEnd, other.cursorEnd);
+    }
+    for (; other.cursor != other.cursorEnd; ++other.cursor)
+        PushFree(other.cursor);
+
+    if (other.freeList)
+    {
+        other.freeTail->next = freeList;
+        if (!freeList)
+            freeTail = other.freeTail;
+        freeList = other.freeList;
+    }
+
+    // Pools forked from each other share slabs, each is kept once.
+    for (auto& slab : other.slabs)
+        slabs.push_back(std::move(slab));
+    std::sort(slabs.begin(), slabs.end(), [](const Slab& a, const Slab& b) { return a.memory < b.memory; });
+    slabs.erase(std::unique(slabs.begin(), slabs.end(), [](const Slab& a, const Slab& b) { return a.memory == b.memory; }),
+                slabs.end());
+
+    capacity = 0;
+    for (const Slab& slab : slabs)
+        capacity += slab.size;
+
+    liveNodes += other.liveNodes;
+    freeNodes += other.freeNodes;
+    lastSlabSize = std::max(lastSlabSize, other.lastSlabSize);
+    totalAllocations += other.totalAllocations;
+
+    other.slabs.clear();
+    other.lastSlabSize = 0;
+    other.freeList = other.freeTail = other.cursor = other.cursorEnd = nullptr;
+    other.capacity = other.liveNodes = other.freeNodes = other.totalAllocations = 0;
+}
+
+std::shared_ptr<NodePool> NodePool::Fork(std::size_t nodeCount)
+{
+    auto pool = std::make_shared<NodePool>();
+    pool->slabs = slabs;
+    pool->capacity = capacity;
+    pool->liveNodes = nodeCount;
+
+    liveNodes -= std::min(liveNodes, nodeCount);
+    return pool;
+}
@@ -0,0 +1,115 @@
+#ifndef NODEPOOL_H
+#define NODEPOOL_H
+
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+#include "node.h"
+
+// Slab allocator for the nodes of one tree. Nodes are carved out of geometrically
+// growing slabs, deleted nodes are kept on a free list and reused by the next
+// insertion, and Release() drops every slab at once without visiting the nodes.
+//
+// Every tree has a pool of its own, so trees can be modified from different threads
+// without locking. Slabs are reference counted: a split Forks the pool for one half,
+// both pools keep the shared slabs alive while their nodes stay where they are, and a
+// join makes one pool Absorb() the other's slabs and free slots.
+class NodePool
+{
+public:
+    struct Statistics
+    {
+        std::size_t slabCount = 0;
+        std::size_t capacity = 0;       // node slots in all slabs
+        std::size_t liveNodes = 0;      // slots currently holding a node
+        std::size_t freeNodes = 0;      // released slots waiting on the free list
+        std::size_t totalAllocations = 0;
+        std::size_t reservedBytes = 0;
+    };
+
+    // Deleter for nodes that are not linked into a tree yet, e.g. while an import is validated.
+    struct Deleter
+    {
+        NodePool* pool;
+        void operator()(Node* node) const { pool->Destroy(node); }
+    };
+    using Handle = std::unique_ptr<Node, Deleter>;
+
+    static constexpr std::size_t MIN_SLAB_SIZE = 64;
+    static constexpr std::size_t MAX_SLAB_SIZE = 64 * 1024;
+
+    NodePool() = default;
+    ~NodePool() = default;
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    template<typename... Args>
+    Node* Create(Args&&... args)
+    {
+        Node* node = new (Allocate()) Node(std::forward<Args>(args)...);
+        ++liveNodes;
+        ++totalAllocations;
+        return node;
+    }
+
+    template<typename... Args>
+    Handle MakeHandle(Args&&... args)
+    {
+        return Handle(Create(std::forward<Args>(args)...), Deleter{this});
+    }
+
+    void Destroy(Node* node);
+
+    // Lets go of all slabs in one step, slabs shared with a forked pool stay alive for
+    // it. Node destructors are not run, so the caller has to Destroy() the nodes that
+    // own memory before releasing the pool.
+    void Release();
+
+    void Reserve(std::size_t nodeCount);
+
+    // Slabs shared with other pools count in each of them.
+    Statistics GetStatistics() const;
+
+    // Takes over the slabs, free slots and counters of other and leaves it empty.
+    // O(number of slabs), no node is touched.
+    void Absorb(NodePool& other);
+
+    // A pool for nodeCount of this pool's nodes that move to another tree. It shares
+    // the slabs, so the nodes stay valid, but allocates from fresh slabs and keeps the
+    // slots it frees. O(number of slabs).
+    std::shared_ptr<NodePool> Fork(std::size_t nodeCount);
+
+private:
+    union Slot
+    {
+        Slot* next;
+        alignas(Node) unsigned char storage[sizeof(Node)];
+    };
+
+    void* Allocate();
+    void AddSlab(std::size_t size);
+    void PushFree(Slot* slot);
+
+    struct Slab
+    {
+        std::shared_ptr<Slot[]> memory;
+        std::size_t size;
+    };
+
+    std::vector<Slab> slabs;
+    std::size_t lastSlabSize = 0;   // 0 after a fork, which starts over with small slabs
+
+    Slot* freeList = nullptr;
+    Slot* freeTail = nullptr;   // lets Absorb() splice free lists without walking them
+    Slot* cursor = nullptr;     // next never used slot of the newest slab
+    Slot* cursorEnd = nullptr;
+
+    std::size_t capacity = 0;
+    std::size_t liveNodes = 0;
+    std::size_t freeNodes = 0;
+    std::size_t totalAllocations = 0;
+};
+
+#endif // NODEPOOL_H
@@ -0,0 +1,66 @@
+#include "redblackmap.h"
+
+RedBlackMap::RedBlackMap()
+{
+    hasPayloads = true;
+}
+
+QVariant* RedBlackMap::InsertOrAssign(const QString& key, QVariant value)
+{
+    bool ok = true;
+    auto data = ConvertValue(GetDataType(), key, ok);
+    if (!ok)
+        return nullptr;
+
+    Node* node = std::visit([this](const auto& k) {
+        using Key = std::decay_t<decltype(k)>;
+        return FindOrInsert<Key>(k).first;
+    }, data);
+
+    node->EnsurePayload() = std::move(value);
+    return &node->EnsurePayload();
+}
+
+std::pair<QVariant*, bool> RedBlackMap::TryEmplace(const QString& key, QVariant value)
+{
+    bool ok = true;
+    auto data = ConvertValue(GetDataType(), key, ok);
+    if (!ok)
+        return { nullptr, false };
+
+    auto [node, isInserted] = std::visit([this](const auto& k) {
+        using Key = std::decay_t<decltype(k)>;
+        return FindOrInsert<Key>(k);
+    }, data);
+
+    if (isInserted)
+        node->EnsurePayload() = std::move(value);
+    return { &node->EnsurePayload(), isInserted };
+}
+
+QVariant* RedBlackMap::FindValue(const QString& key)
+{
+    bool ok = true;
+    auto data = ConvertValue(GetDataType(), key, ok);
+    if (!ok)
+        return nullptr;
+
+    const Node* node = std::visit([this](const auto& k) {
+        using Key = std::decay_t<decltype(k)>;
+        KeyCompare<Key> compare;
+
+        const Node* x = GetRoot();
+        while (x != NIL)
+        {
+            if (compare(k, x->GetData<Key>()))
+                x = x->left;
+            else if (compare(x->GetData<Key>(), k))
+                x = x->right;
+            else
+                break;
+        }
+        return x;
+    }, data);
+
+    return node != NIL && !node->IsTombstone() ? &const_cast<Node*>(node)->EnsurePayload() : nullptr;
+}
@@ -0,0 +1,26 @@
+#ifndef REDBLACKMAP_H
+#define REDBLACKMAP_H
+
+#include <QVariant>
+#include "redblacktree.h"
+
+// Ordered map on top of the tree, every node keeps its value in place. Each call takes
+// a single descent and values are moved into the nodes, not copied.
+class RedBlackMap : public RedBlackTree
+{
+public:
+    RedBlackMap();
+
+    // Stores value under key, replacing an existing value. Returns the stored value or
+    // nullptr when key is invalid.
+    QVariant* InsertOrAssign(const QString& key, QVariant value);
+
+    // Stores value only when key is missing. Returns the value held under key and
+    // whether it was inserted.
+    std::pair<QVariant*, bool> TryEmplace(const QString& key, QVariant value);
+
+    // Returns the value held under key or nullptr when it is missing.
+    QVariant* FindValue(const QString& key);
+};
+
+#endif // REDBLACKMAP_H
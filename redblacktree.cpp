@@ -7,11 +7,333 @@
 #include <QXmlStreamReader>
 #include <QXmlStreamWriter>
 #include <QQueue>
+#include <QSignalBlocker>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <utility>
 
 RedBlackTree::RedBlackTree() :
-    root(NIL), height(0), nodeCount(0), enableRBTValidations(true)
+    root(NIL), pool(std::make_shared<NodePool>()), nodeCount(0), leftmost(NIL), rightmost(NIL), indexLookups(0), indexHits(0), isLazyDelete(false), compactionThreshold(0.25), tombstoneCount(0), isRelaxedBalance(false), height(0), isHeightStale(false), dataType(DataType::NUMBER), isMultiset(false), enableRBTValidations(true), hasPayloads(false)
 {}
 
+RedBlackTree::~RedBlackTree()
+{
+    ReleaseNodes();
+}
+
+void RedBlackTree::ResetCaches()
+{
+    leftmost = const_cast<Node*>(Leftmost(root));
+    rightmost = const_cast<Node*>(Rightmost(root));
+
+    if (hashIndex)
+    {
+        hashIndex->clear();
+        hashIndex->reserve(root->size);
+        for (const Node& node : *this)
+            hashIndex->insert(node.data, const_cast<Node*>(&node));
+    }
+}
+
+void RedBlackTree::CacheLinked(Node* z)
+{
+    Node* parent = z->parent;
+    if (parent == NIL)
+        leftmost = rightmost = z;
+    else if (z == parent->left && parent == leftmost)
+        leftmost = z;
+    else if (z == parent->right && parent == rightmost)
+        rightmost = z;
+
+    if (hashIndex)
+        hashIndex->insert(z->data, z);
+}
+
+void RedBlackTree::CacheUnlinked(Node* z)
+{
+    Unindex(z);
+
+    // The minimum has no left child, so its successor is in its right subtree, a single
+    // red node at most, or its parent. The maximum mirrors that.
+    if (z == leftmost)
+        leftmost = z->right != NIL ? const_cast<Node*>(Leftmost(z->right)) : z->parent;
+    if (z == rightmost)
+        rightmost = z->left != NIL ? const_cast<Node*>(Rightmost(z->left)) : z->parent;
+}
+
+void RedBlackTree::Unindex(Node* z)
+{
+    // Equal keys are neighbours in order, the index moves on to one of them if z had
+    // duplicates.
+    if (hashIndex && hashIndex->value(z->data, NIL) == z)
+    {
+        const_iterator next(z, this), previous(z, this);
+        ++next;
+        if (next != end() && next->data == z->data)
+            hashIndex->insert(z->data, const_cast<Node*>(&*next));
+        else if (z != leftmost && --previous != end() && previous->data == z->data)
+            hashIndex->insert(z->data, const_cast<Node*>(&*previous));
+        else
+            hashIndex->remove(z->data);
+    }
+}
+
+void RedBlackTree::SetHashIndex(bool enabled)
+{
+    if (!enabled)
+    {
+        hashIndex.reset();
+        return;
+    }
+
+    if (!hashIndex)
+    {
+        hashIndex = std::make_unique<QHash<NodeData, Node*>>();
+        indexLookups = indexHits = 0;
+        ResetCaches();
+    }
+}
+
+RedBlackTree::HashIndexStatistics RedBlackTree::GetHashIndexStatistics() const
+{
+    HashIndexStatistics statistics;
+    if (!hashIndex)
+        return statistics;
+
+    statistics.entries = hashIndex->size();
+    statistics.buckets = hashIndex->capacity();
+    statistics.approximateBytes = statistics.buckets * sizeof(void*) +
+                                  statistics.entries * (sizeof(NodeData) + sizeof(Node*));
+    statistics.lookups = indexLookups;
+    statistics.hits = indexHits;
+    return statistics;
+}
+
+bool RedBlackTree::FindIndexed(const NodeData& key)
+{
+    ++indexLookups;
+    Node* node = hashIndex->value(key, NIL);
+    if (node == NIL)
+        return false;
+
+    ++indexHits;
+    RBT_EMIT(HighlightNodeSignal(node, QColor(Qt::green)));
+    return true;
+}
+
+std::optional<NodeData> RedBlackTree::ExtractMin()
+{
+    return Extract(const_cast<Node*>(Min()));
+}
+
+std::optional<NodeData> RedBlackTree::ExtractMax()
+{
+    return Extract(const_cast<Node*>(Max()));
+}
+
+std::optional<NodeData> RedBlackTree::Extract(Node* z)
+{
+    if (z == NIL)
+        return std::nullopt;
+
+    RBT_EMIT(HighlightNodeSignal(z, QColor(Qt::magenta)));
+
+    if (isMultiset && z->count > 1)
+    {
+        --z->count;
+        return z->data;
+    }
+
+    if (isLazyDelete)
+    {
+        NodeData data = z->data;
+        Bury(z);
+        return data;
+    }
+
+    UnlinkNode(z);
+    NodeData data = std::move(z->data);
+    pool->Destroy(z);
+
+    UpdateHeight();
+    RBT_EMIT(UpdateNodeCountSignal());
+
+    return data;
+}
+
+void RedBlackTree::SetLazyDelete(bool enabled, double compactionThreshold)
+{
+    isLazyDelete = enabled;
+    this->compactionThreshold = compactionThreshold;
+
+    if (!enabled)
+        Compact();
+}
+
+// Only the path to the root is recounted, z now adds nothing to the sizes and
+// aggregates of its ancestors.
+void RedBlackTree::Bury(Node* z)
+{
+    Unindex(z);
+    z->count = 0;
+    for (Node* node = z; node != NIL; node = node->parent)
+        PullUp(node);
+
+    ++tombstoneCount;
+    --nodeCount;
+
+    if (tombstoneCount > compactionThreshold * (nodeCount + tombstoneCount))
+        Compact();
+    else
+        RBT_EMIT(UpdateNodeCountSignal());
+}
+
+void RedBlackTree::Revive(Node* z)
+{
+    z->count = 1;
+    for (Node* node = z; node != NIL; node = node->parent)
+        PullUp(node);
+
+    if (hashIndex && !hashIndex->contains(z->data))
+        hashIndex->insert(z->data, z);
+
+    --tombstoneCount;
+    ++nodeCount;
+    RBT_EMIT(UpdateNodeCountSignal());
+}
+
+// Drops the tombstones and relinks the live nodes balanced, like the bulk rebuilds.
+void RedBlackTree::Compact()
+{
+    if (tombstoneCount == 0)
+        return;
+
+    std::vector<Node*> live, tombstones;
+    live.reserve(nodeCount);
+    tombstones.reserve(tombstoneCount);
+
+    for (const Node* node = leftmost; node != NIL; node = Successor(node))
+        (node->IsTombstone() ? tombstones : live).push_back(const_cast<Node*>(node));
+
+    for (Node* node : tombstones)
+        pool->Destroy(node);
+
+    root = BuildBalanced(live);
+    nodeCount = live.size();
+    tombstoneCount = 0;
+    pendingFixups.clear();
+    ResetCaches();
+
+    UpdateHeight();
+    RBT_EMIT(UpdateNodeCountSignal());
+}
+
+void RedBlackTree::SetRelaxedBalance(bool enabled)
+{
+    isRelaxedBalance = enabled;
+
+    if (!enabled)
+        Rebalance();
+}
+
+// Every queued node starts out as a red leaf, so the black heights still agree and only
+// red nodes may follow each other. InsertFixupStep expects a black grandparent, which
+// the topmost pair of a red run has, the rest of the run stays queued. Recoloring
+// removes a red node and a rotation a red pair, so the repair terminates.
+void RedBlackTree::Rebalance()
+{
+    if (pendingFixups.empty())
+        return;
+
+    if (PreferRebuild(pendingFixups.size()))
+    {
+        std::vector<Node*> nodes;
+        nodes.reserve(nodeCount + tombstoneCount);
+        for (const Node* node = leftmost; node != NIL; node = Successor(node))
+            nodes.push_back(const_cast<Node*>(node));
+
+        root = BuildBalanced(nodes);
+        pendingFixups.clear();
+        UpdateHeight();
+        return;
+    }
+
+    for (std::size_t i = 0; i < pendingFixups.size(); ++i)
+    {
+        Node* z = pendingFixups[i];
+        if (z->color == Color::BLACK || z->parent->color == Color::BLACK)
+            continue;
+
+        Node* top = z;
+        while (top->parent->parent->color == Color::RED)
+            top = top->parent;
+        if (top != z)
+            pendingFixups.push_back(z);
+
+        if (top->parent == root)
+        {
+            RBT_EMIT(ChangeColorSignal(root, Color::BLACK));
+            root->color = Color::BLACK;
+        }
+        else
+            pendingFixups.push_back(Engine::InsertFixupStep(*this, top));
+    }
+    pendingFixups.clear();
+
+    RBT_EMIT(ChangeColorSignal(root, Color::BLACK));
+    root->color = Color::BLACK;
+    UpdateHeight();
+}
+
+void RedBlackTree::Settle()
+{
+    Compact();
+    Rebalance();
+}
+
+void RedBlackTree::EnableTrace(std::size_t capacity)
+{
+    trace = std::make_unique<TraceBuffer>(capacity);
+}
+
+void RedBlackTree::ReleaseNodes()
+{
+    // Number and character keys without payloads own no memory, so their nodes don't
+    // have to be visited and the pool can drop its slabs right away. Slabs shared with
+    // the other half of a split stay alive for it.
+    if (dataType == DataType::TEXT || hasPayloads)
+        DestroyTree(root);
+    pool->Release();
+
+    root = NIL;
+    tombstoneCount = 0;
+    pendingFixups.clear();
+    ResetCaches();
+}
+
+void RedBlackTree::DestroyTree(Node* node)
+{
+    QList<Node*> stack;
+
+    if (node != NIL)
+        stack.append(node);
+
+    while (!stack.isEmpty())
+    {
+        node = stack.takeLast();
+
+        if (node->left != NIL && node->left != nullptr)
+            stack.append(node->left);
+        if (node->right != NIL && node->right != nullptr)
+            stack.append(node->right);
+
+        pool->Destroy(node);
+    }
+}
+
 void RedBlackTree::SetTreeDataType(DataType dataType)
 {
     this->dataType = dataType;
@@ -30,6 +352,9 @@ bool RedBlackTree::SetTreeDataType(char type)
     case 't':
         dataType = DataType::TEXT;
         return true;
+    case 'i':
+        dataType = DataType::INTERVAL;
+        return true;
     default:
         return false;
     }
@@ -45,6 +370,8 @@ QChar RedBlackTree::GetTreeDataTypeChar() const
         return 'c';
     case DataType::TEXT:
         return 't';
+    case DataType::INTERVAL:
+        return 'i';
     default:
         return QChar();
     }
@@ -62,13 +389,12 @@ bool RedBlackTree::TryGetColorFromChar(const QChar &colorChar, Color& color)
         return true;
     default:
         emit ErrorMessageSignal("Invalid color!");
-        root = NIL;
         return false;
     }
 }
 
 
-quint16 RedBlackTree::CalculateHeight(std::shared_ptr<Node> node)
+quint32 RedBlackTree::CalculateHeight(const Node* node) const
 {
     if (node == NIL)
         return 0;
@@ -79,40 +405,78 @@ quint16 RedBlackTree::CalculateHeight(std::shared_ptr<Node> node)
 
 void RedBlackTree::UpdateHeight()
 {
-    height = CalculateHeight(root);
-    emit UpdateHeightSignal();
+    isHeightStale = true;
+    RBT_EMIT(UpdateHeightSignal());
+}
+
+quint32 RedBlackTree::GetHeight() const
+{
+    if (isHeightStale)
+    {
+        height = CalculateHeight(root);
+        isHeightStale = false;
+    }
+    return height;
+}
+
+// A red-black tree with n nodes is never higher than 2 * log2(n + 1), tombstones count
+// as nodes here.
+quint32 RedBlackTree::GetHeightBound() const
+{
+    quint64 linked = nodeCount + tombstoneCount;
+    quint32 bits = 0;
+    for (quint64 n = linked + 1; n > 1; n >>= 1)
+        ++bits;
+
+    // bits is floor(log2(n + 1)), round it up unless n + 1 is a power of two
+    if ((quint64{1} << bits) != linked + 1)
+        ++bits;
+
+    return 2 * bits;
 }
 
-quint16 RedBlackTree::CalculateNodeCount(std::shared_ptr<Node> node)
+void RedBlackTree::PullUpSubtree(Node* node)
 {
     if (node == NIL)
-        return 0;
+        return;
 
-    return 1 + CalculateNodeCount(node->left) + CalculateNodeCount(node->right);
+    PullUpSubtree(node->left);
+    PullUpSubtree(node->right);
+    PullUp(node);
 }
 
 
 void RedBlackTree::UpdateNodeCount()
 {
-    nodeCount = CalculateNodeCount(root);
-    emit UpdateNodeCountSignal();
+    PullUpSubtree(root);
+    nodeCount = root->size;
+    RBT_EMIT(UpdateNodeCountSignal());
 }
 
 
-quint16 RedBlackTree::GetNewNodeHeight(const QString &key)
+quint32 RedBlackTree::GetNewNodeHeight(const QString &key)
 {
     bool ok = true;
     auto data = ConvertValue(dataType, key, ok);
     if (!ok)
         return 0;
 
-    auto z = std::make_shared<Node>(data, Color::RED);
-    auto x = root;
+    return std::visit([this](const auto& value) {
+        using Key = std::decay_t<decltype(value)>;
+        return GetNewNodeHeight<Key>(value);
+    }, data);
+}
+
+template<typename Key, typename Compare>
+quint32 RedBlackTree::GetNewNodeHeight(const Key& key) const
+{
+    Compare compare;
+    const Node* x = root;
 
-    int nodeHeight = 0;
+    quint32 nodeHeight = 0;
     while (x != NIL)
     {
-        if (z->CompareData(x->data))
+        if (compare(key, x->GetData<Key>()))
             x = x->left;
         else
             x = x->right;
@@ -122,35 +486,79 @@ quint16 RedBlackTree::GetNewNodeHeight(const QString &key)
     return nodeHeight + 1;
 }
 
-bool RedBlackTree::IsBST(std::shared_ptr<Node> node) const
+bool RedBlackTree::IsBST(const Node* node) const
 {
-    std::shared_ptr<Node> prev = NIL;
-    return IsValidBST(node, prev);
+    if (node == NIL)
+        return true;
+
+    return std::visit([this, node](const auto& value) {
+        using Key = std::decay_t<decltype(value)>;
+        const Node* prev = NIL;
+        return IsValidBST<Key>(node, prev);
+    }, node->data);
 }
 
-bool RedBlackTree::IsValidBST(std::shared_ptr<Node> node, std::shared_ptr<Node> &prev) const
+template<typename Key, typename Compare>
+bool RedBlackTree::IsValidBST(const Node* node, const Node*& prev) const
 {
     if (node == NIL)
         return true;
 
-    bool left = IsValidBST(node->left, prev);
+    bool left = IsValidBST<Key, Compare>(node->left, prev);
 
-    if (prev != NIL && node->CompareData(prev->data))
+    if (prev != NIL && Compare()(node->GetData<Key>(), prev->GetData<Key>()))
         return false;
 
     prev = node;
 
-    bool right = IsValidBST(node->right, prev);
+    bool right = IsValidBST<Key, Compare>(node->right, prev);
 
     return left && right;
 }
 
-bool RedBlackTree::IsBlackBalanced(std::shared_ptr<Node> root) const
+bool RedBlackTree::IsBlackBalanced(const Node* root) const
 {
     return root->GetBlackHeight() != -1;
 }
 
-bool RedBlackTree::ColorValidation(std::shared_ptr<Node> node) const
+RedBlackTree::BalanceReport RedBlackTree::CheckBalance() const
+{
+    BalanceReport report;
+    report.isRootBlack = root->color == Color::BLACK;
+    report.isBlackBalanced = CheckBalance(root, 0, 0, report) != -1;
+    report.heightBound = GetHeightBound();
+    report.pendingFixups = pendingFixups.size();
+    return report;
+}
+
+// Returns the black height of the subtree, -1 when its paths disagree. redRun counts
+// the red nodes directly above node.
+qint32 RedBlackTree::CheckBalance(const Node* node, quint32 depth, quint32 redRun, BalanceReport& report) const
+{
+    if (node == NIL)
+    {
+        report.height = std::max(report.height, depth);
+        return 0;
+    }
+
+    if (node->color == Color::RED)
+    {
+        if (redRun > 0)
+            ++report.redViolations;
+        report.longestRedRun = std::max(report.longestRedRun, ++redRun);
+    }
+    else
+        redRun = 0;
+
+    qint32 left = CheckBalance(node->left, depth + 1, redRun, report);
+    qint32 right = CheckBalance(node->right, depth + 1, redRun, report);
+    if (left == -1 || left != right)
+        return -1;
+
+    return left + (node->color == Color::BLACK ? 1 : 0);
+}
+
+bool RedBlackTree::ColorValidation(const Node* node) const
 {
     if (node == NIL)
         return true;
@@ -174,288 +582,1543 @@ bool RedBlackTree::ColorValidation(std::shared_ptr<Node> node) const
     return ColorValidation(node->left) && ColorValidation(node->right);
 }
 
-void RedBlackTree::LeftRotate(std::shared_ptr<Node> x)
+const Node* RedBlackTree::Select(quint64 k) const
 {
-    auto y = x->right;
+    const Node* x = root;
 
-    emit MoveStartSignal(x, y, false, true);
-    x->right = y->left;
-
-    if (y->left != NIL)
+    while (x != NIL)
     {
-        emit ChangeParentSignal(y->left, x);
-        y->left->parent = x;
-    }
-
-    emit ChangeParentSignal(y, x->parent.lock());
-    y->parent = x->parent;
+        quint64 leftSize = x->left->size;
 
-    auto xp = x->parent.lock();
-    if (xp == NIL)
-    {
-        emit MoveYSignal(y, root, true, true, true);
-        root = y;
-    }
-    else if (x == xp->left)
-    {
-        emit MoveYSignal(y, xp, true, true);
-        xp->left = y;
-    }
-    else
-    {
-        emit MoveYSignal(y, xp, false, true);
-        xp->right = y;
+        if (k < leftSize)
+            x = x->left;
+        else if (k == leftSize && !x->IsTombstone())
+            return x;
+        else
+        {
+            k -= leftSize + (x->IsTombstone() ? 0 : 1);
+            x = x->right;
+        }
     }
-
-    emit MoveXSignal(x, y, true);
-    emit ChangeParentSignal(x, y);
-
-    y->left = x;
-    x->parent = y;
-
-    emit LeftRotateSignal(x);
+    return NIL;
 }
 
-void RedBlackTree::RightRotate(std::shared_ptr<Node> x)
+quint64 RedBlackTree::Rank(const QString& key)
 {
-    auto y = x->left;
-
-    emit MoveStartSignal(x, y, true, false);
-    x->left = y->right;
-
-    if (y->right != NIL)
-    {
-        emit ChangeParentSignal(y->right, x);
-        y->right->parent = x;
-    }
-
-    emit ChangeParentSignal(y, x->parent.lock());
-    y->parent = x->parent;
-
-    auto xp = x->parent.lock();
-    if (xp == NIL)
-    {
-        emit MoveYSignal(y, root, true, false, true);
-        root = y;
-    }
-    else if (x == xp->left)
-    {
-        emit MoveYSignal(y, xp, true, false);
-        xp->left = y;
-    }
-    else
-    {
-        emit MoveYSignal(y, xp, false, false);
-        xp->right = y;
-    }
-
-    emit MoveXSignal(x, y, false);
-    emit ChangeParentSignal(x, y);
-
-    y->right = x;
-    x->parent = y;
+    bool ok = true;
+    auto data = ConvertValue(dataType, key, ok);
+    if (!ok)
+        return 0;
 
-    emit RightRotateSignal(x);
+    return std::visit([this](const auto& value) {
+        using Key = std::decay_t<decltype(value)>;
+        return CountBelow<Key>(value, false);
+    }, data);
 }
 
-void RedBlackTree::Insert(const QString& key)
+quint64 RedBlackTree::CountRange(const QString& lo, const QString& hi)
 {
     bool ok = true;
-    auto data = ConvertValue(dataType, key, ok);
+    auto loData = ConvertValue(dataType, lo, ok);
     if (!ok)
-        return;
+        return 0;
+    auto hiData = ConvertValue(dataType, hi, ok);
+    if (!ok)
+        return 0;
+
+    return std::visit([this, &hiData](const auto& value) -> quint64 {
+        using Key = std::decay_t<decltype(value)>;
+        const Key& upper = std::get<Key>(hiData);
+
+        if (KeyCompare<Key>()(upper, value))
+            return 0;
 
-    auto z = std::make_shared<Node>(data, Color::RED);
-    emit CreateNodeSignal(z);
+        return CountBelow<Key>(upper, true) - CountBelow<Key>(value, false);
+    }, loData);
+}
 
-    auto x = root;
-    auto y = NIL;
+// Number of keys smaller than key, or not greater than key when inclusive is set.
+template<typename Key, typename Compare>
+quint64 RedBlackTree::CountBelow(const Key& key, bool inclusive) const
+{
+    Compare compare;
+    const Node* x = root;
+    quint64 count = 0;
 
     while (x != NIL)
     {
-        y = x;
+        const Key& nodeKey = x->GetData<Key>();
+        bool goesLeft = inclusive ? compare(key, nodeKey) : !compare(nodeKey, key);
 
-        if (z->CompareData(x->data))
-        {
-            emit HighlightNodeSignal(x, Qt::blue, true, key);
+        if (goesLeft)
             x = x->left;
-        }
         else
         {
-            emit HighlightNodeSignal(x, Qt::blue, false, key);
+            count += x->left->size + (x->IsTombstone() ? 0 : 1);
             x = x->right;
         }
     }
+    return count;
+}
 
-    z->parent = y;
+void RedBlackTree::ForEachInRange(const QString& lo, const QString& hi, const std::function<void(const Node&)>& callback)
+{
+    bool ok = true;
+    auto loData = ConvertValue(dataType, lo, ok);
+    if (!ok)
+        return;
+    auto hiData = ConvertValue(dataType, hi, ok);
+    if (!ok)
+        return;
 
-    if (y == NIL)
-    {
-        emit MoveNodeSignal(z, root, true, true);
-        root = z;
-    }
-    else if (z->CompareData(y->data))
-    {
-        emit MoveNodeSignal(z, y, true);
-        y->left = z;
-    }
-    else
-    {
-        emit MoveNodeSignal(z, y, false);
-        y->right = z;
-    }
+    std::visit([this, &hiData, &callback](const auto& value) {
+        using Key = std::decay_t<decltype(value)>;
+        const Key& upper = std::get<Key>(hiData);
+        KeyCompare<Key> compare;
 
-    z->left = NIL;
-    z->right = NIL;
+        for (const_iterator it = lower_bound<Key>(value); it != end() && !compare(upper, it->GetData<Key>()); ++it)
+            callback(*it);
+    }, loData);
+}
+
+quint64 RedBlackTree::DeleteRange(const QString& lo, const QString& hi)
+{
+    bool ok = true;
+    auto loData = ConvertValue(dataType, lo, ok);
+    if (!ok)
+        return 0;
+    auto hiData = ConvertValue(dataType, hi, ok);
+    if (!ok)
+        return 0;
 
-    InsertFixup(z);
+    Settle();
 
-    UpdateHeight();
-    UpdateNodeCount();
+    return std::visit([this, &hiData](const auto& value) {
+        using Key = std::decay_t<decltype(value)>;
+        return DeleteRange<Key>(value, std::get<Key>(hiData));
+    }, loData);
 }
 
-
-void RedBlackTree::InsertFixup(std::shared_ptr<Node> z)
+template<typename Key, typename Compare>
+quint64 RedBlackTree::DeleteRange(const Key& lo, const Key& hi)
 {
-    std::shared_ptr<Node> y;
+    Compare compare;
+    if (compare(hi, lo))
+        return 0;
 
-    while (z->parent.lock()->color == Color::RED)
-    {
-        auto zp = z->parent.lock();
-        auto zpp = zp->parent.lock();
+    quint64 first = CountBelow<Key, Compare>(lo, false);
+    quint64 count = CountBelow<Key, Compare>(hi, true) - first;
+    if (count == 0)
+        return 0;
+
+    std::vector<Node*> removed;
+    removed.reserve(count);
+    for (auto it = lower_bound<Key, Compare>(lo); removed.size() < count; ++it)
+        removed.push_back(const_cast<Node*>(&*it));
+
+    if (!PreferRebuild(count))
+    {
+        // Few keys, unlink them one by one without searching for them again.
+        QSignalBlocker blocker(this);
+        for (Node* node : removed)
+            DeleteNode(node);
+    }
+    else
+    {
+        // Most of the tree goes away, rebuilding from the survivors is linear.
+        std::vector<Node*> kept;
+        kept.reserve(nodeCount - count);
 
-        if (zp == zpp->left)
+        quint64 index = 0;
+        for (auto it = begin(); it != end(); ++it, ++index)
         {
-            y = zpp->right;
-            if (y->color == Color::RED)
-            {
-                emit ChangeColorSignal(zp, Color::BLACK);
-                emit ChangeColorSignal(y, Color::BLACK);
-                emit ChangeColorSignal(zpp, Color::RED);
-
-                zp->color = Color::BLACK;
-                y->color = Color::BLACK;
-                zpp->color = Color::RED;
-                z = zpp;
-            }
+            if (index < first || index >= first + count)
+                kept.push_back(const_cast<Node*>(&*it));
+        }
+
+        for (Node* node : removed)
+            pool->Destroy(node);
+
+        root = BuildBalanced(kept);
+        nodeCount = kept.size();
+        ResetCaches();
+    }
+
+    UpdateHeight();
+    RBT_EMIT(UpdateNodeCountSignal());
+    return count;
+}
+
+bool RedBlackTree::BuildFromSorted(const QStringList& keys)
+{
+    std::vector<NodeData> values;
+    if (!ConvertValues(keys, values))
+        return false;
+
+    if (!IsSorted(values))
+    {
+        emit ErrorMessageSignal("Keys must be in ascending order!");
+        return false;
+    }
+
+    Assign(values);
+    return true;
+}
+
+// counts is either empty or holds the multiplicity of every value.
+void RedBlackTree::Assign(const std::vector<NodeData>& values, const std::vector<quint32>& counts)
+{
+    ReleaseNodes();
+    pool->Reserve(values.size());
+
+    std::vector<Node*> nodes;
+    nodes.reserve(values.size());
+    for (std::size_t i = 0; i < values.size(); ++i)
+    {
+        quint32 count = counts.empty() ? 1 : counts[i];
+        if (isMultiset && !nodes.empty() && SameKey(nodes.back()->data, values[i]))
+        {
+            nodes.back()->count += count;
+            continue;
+        }
+
+        nodes.push_back(pool->Create(values[i], Color::BLACK));
+        if (isMultiset)
+            nodes.back()->count = count;
+    }
+
+    root = BuildBalanced(nodes);
+    nodeCount = nodes.size();
+    ResetCaches();
+
+    UpdateHeight();
+    RBT_EMIT(UpdateNodeCountSignal());
+}
+
+bool RedBlackTree::ConvertValues(const QStringList& keys, std::vector<NodeData>& values)
+{
+    bool ok = true;
+    values.reserve(values.size() + keys.size());
+
+    for (const QString& key : keys)
+    {
+        values.push_back(ConvertValue(dataType, key, ok));
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+bool RedBlackTree::IsSorted(const std::vector<NodeData>& values)
+{
+    if (values.empty())
+        return true;
+
+    return std::visit([&values](const auto& first) {
+        using Key = std::decay_t<decltype(first)>;
+        return std::is_sorted(values.begin(), values.end(), [](const NodeData& a, const NodeData& b) {
+            return KeyCompare<Key>()(std::get<Key>(a), std::get<Key>(b));
+        });
+    }, values.front());
+}
+
+void RedBlackTree::SortValues(std::vector<NodeData>& values)
+{
+    if (IsSorted(values))
+        return;
+
+    if (std::holds_alternative<qint16>(values.front()))
+    {
+        RadixSort(values);
+        return;
+    }
+
+    // Visits a copy, the front element moves while sorting.
+    std::visit([&values](const auto& first) {
+        using Key = std::decay_t<decltype(first)>;
+        std::stable_sort(values.begin(), values.end(), [](const NodeData& a, const NodeData& b) {
+            return KeyCompare<Key>()(std::get<Key>(a), std::get<Key>(b));
+        });
+    }, NodeData(values.front()));
+}
+
+// Sorts the values together with their counts, used for multiset key lists.
+void RedBlackTree::SortValues(std::vector<NodeData>& values, std::vector<quint32>& counts)
+{
+    if (IsSorted(values))
+        return;
+
+    std::vector<std::size_t> order(values.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+
+    std::visit([&values, &order](const auto& first) {
+        using Key = std::decay_t<decltype(first)>;
+        std::stable_sort(order.begin(), order.end(), [&values](std::size_t a, std::size_t b) {
+            return KeyCompare<Key>()(std::get<Key>(values[a]), std::get<Key>(values[b]));
+        });
+    }, values.front());
+
+    std::vector<NodeData> sortedValues;
+    std::vector<quint32> sortedCounts;
+    sortedValues.reserve(values.size());
+    sortedCounts.reserve(counts.size());
+    for (std::size_t i : order)
+    {
+        sortedValues.push_back(std::move(values[i]));
+        sortedCounts.push_back(counts[i]);
+    }
+
+    values.swap(sortedValues);
+    counts.swap(sortedCounts);
+}
+
+// Two 8-bit LSD passes over the keys with their sign bit flipped, so negative
+// numbers order before positive ones.
+void RedBlackTree::RadixSort(std::vector<NodeData>& values)
+{
+    std::vector<quint16> keys(values.size()), buffer(values.size());
+    for (size_t i = 0; i < values.size(); ++i)
+        keys[i] = static_cast<quint16>(std::get<qint16>(values[i])) ^ 0x8000;
+
+    for (int shift : { 0, 8 })
+    {
+        std::array<size_t, 257> offsets{};
+        for (quint16 key : keys)
+            ++offsets[((key >> shift) & 0xFF) + 1];
+
+        for (size_t i = 1; i < offsets.size(); ++i)
+            offsets[i] += offsets[i - 1];
+
+        for (quint16 key : keys)
+            buffer[offsets[(key >> shift) & 0xFF]++] = key;
+
+        keys.swap(buffer);
+    }
+
+    for (size_t i = 0; i < values.size(); ++i)
+        values[i] = static_cast<qint16>(keys[i] ^ 0x8000);
+}
+
+// Past roughly n / log n keys, relinking everything in O(n) beats separate descents.
+bool RedBlackTree::PreferRebuild(quint64 batchSize) const
+{
+    return batchSize * (GetHeightBound() / 2 + 1) >= nodeCount;
+}
+
+bool RedBlackTree::InsertBatch(const QStringList& keys)
+{
+    std::vector<NodeData> values;
+    if (!ConvertValues(keys, values))
+        return false;
+
+    if (values.empty())
+        return true;
+
+    Settle();
+    SortValues(values);
+
+    std::visit([this, &values](const auto& first) {
+        using Key = std::decay_t<decltype(first)>;
+        InsertBatch<Key>(values);
+    }, NodeData(values.front()));
+
+    UpdateHeight();
+    RBT_EMIT(UpdateNodeCountSignal());
+    return true;
+}
+
+template<typename Key, typename Compare>
+void RedBlackTree::InsertBatch(const std::vector<NodeData>& values)
+{
+    if (!PreferRebuild(values.size()))
+    {
+        QSignalBlocker blocker(this);
+        for (const NodeData& value : values)
+            Insert<Key, Compare>(std::get<Key>(value), QString());
+        return;
+    }
+
+    std::vector<Node*> existing, added, merged;
+    existing.reserve(nodeCount);
+    for (auto it = begin(); it != end(); ++it)
+        existing.push_back(const_cast<Node*>(&*it));
+
+    pool->Reserve(values.size());
+    added.reserve(values.size());
+    for (const NodeData& value : values)
+        added.push_back(pool->Create(value, Color::BLACK));
+
+    // std::merge is stable, new keys end up after equal ones like with Insert.
+    merged.resize(existing.size() + added.size());
+    std::merge(existing.begin(), existing.end(), added.begin(), added.end(), merged.begin(),
+               [](const Node* a, const Node* b) { return Compare()(a->GetData<Key>(), b->GetData<Key>()); });
+
+    if (isMultiset)
+    {
+        // Equal keys are adjacent now, the first node of each run takes their counts.
+        auto last = merged.begin();
+        for (auto it = merged.begin() + 1; it < merged.end(); ++it)
+        {
+            if (Compare()((*last)->GetData<Key>(), (*it)->GetData<Key>()))
+                *++last = *it;
             else
             {
-                if (z == zp->right)
-                {
-                    z = zp;
-                    LeftRotate(z);
-                }
+                (*last)->count += (*it)->count;
+                pool->Destroy(*it);
+            }
+        }
+        merged.erase(last + 1, merged.end());
+    }
 
-                auto zp = z->parent.lock();
-                auto zpp = zp->parent.lock();
+    root = BuildBalanced(merged);
+    nodeCount = merged.size();
+    ResetCaches();
+}
+
+quint64 RedBlackTree::DeleteBatch(const QStringList& keys)
+{
+    std::vector<NodeData> values;
+    if (!ConvertValues(keys, values) || values.empty())
+        return 0;
+
+    Settle();
+    SortValues(values);
+
+    quint64 removed = std::visit([this, &values](const auto& first) {
+        using Key = std::decay_t<decltype(first)>;
+        return DeleteBatch<Key>(values);
+    }, NodeData(values.front()));
+
+    UpdateHeight();
+    RBT_EMIT(UpdateNodeCountSignal());
+    return removed;
+}
+
+template<typename Key, typename Compare>
+quint64 RedBlackTree::DeleteBatch(const std::vector<NodeData>& values)
+{
+    Compare compare;
+
+    if (!PreferRebuild(values.size()))
+    {
+        QSignalBlocker blocker(this);
+        quint64 removed = 0;
 
-                emit ChangeColorSignal(zp, Color::BLACK);
-                emit ChangeColorSignal(zpp, Color::RED);
+        for (const NodeData& value : values)
+        {
+            const Key& key = std::get<Key>(value);
+            const_iterator it = lower_bound<Key, Compare>(key);
 
-                zp->color = Color::BLACK;
-                zpp->color = Color::RED;
-                RightRotate(zpp);
+            if (it != end() && !compare(key, it->GetData<Key>()))
+            {
+                Node* node = const_cast<Node*>(&*it);
+                if (isMultiset && node->count > 1)
+                    --node->count;
+                else
+                    DeleteNode(node);
+                ++removed;
             }
         }
-        else
+        return removed;
+    }
+
+    // Walks the tree and the sorted batch side by side, every batch key removes one copy.
+    std::vector<Node*> kept, removed;
+    kept.reserve(nodeCount);
+    quint64 removedCount = 0;
+    size_t i = 0;
+
+    for (auto it = begin(); it != end(); ++it)
+    {
+        Node* node = const_cast<Node*>(&*it);
+        const Key& key = node->GetData<Key>();
+        while (i < values.size() && compare(std::get<Key>(values[i]), key))
+            ++i;
+
+        if (i < values.size() && !compare(key, std::get<Key>(values[i])))
         {
-            y = zpp->left;
-            if (y->color == Color::RED)
+            quint32 count = node->count;
+            for (; node->count > 0 && i < values.size() && !compare(key, std::get<Key>(values[i])); ++i)
+                --node->count;
+            removedCount += count - node->count;
+
+            if (node->count == 0)
             {
-                emit ChangeColorSignal(zp, Color::BLACK);
-                emit ChangeColorSignal(y, Color::BLACK);
-                emit ChangeColorSignal(zpp, Color::RED);
-
-                zp->color = Color::BLACK;
-                y->color = Color::BLACK;
-                zpp->color = Color::RED;
-                z = zpp;
+                removed.push_back(node);
+                continue;
             }
-            else
-            {
-                if (z == zp->left)
-                {
-                    z = zp;
-                    RightRotate(z);
-                }
+        }
+        kept.push_back(node);
+    }
+
+    for (Node* node : removed)
+        pool->Destroy(node);
+
+    root = BuildBalanced(kept);
+    nodeCount = kept.size();
+    ResetCaches();
+    return removedCount;
+}
+
+// Links sorted nodes into a perfectly balanced tree. Splitting at the middle keeps all
+// NIL leaves within one level of each other, so coloring the deepest level red whenever
+// it is incomplete gives every path the same black height.
+Node* RedBlackTree::BuildBalanced(const std::vector<Node*>& nodes)
+{
+    quint64 n = nodes.size();
+    quint32 redDepth = std::numeric_limits<quint32>::max();
+
+    if (n > 0 && ((n + 1) & n) != 0)
+    {
+        redDepth = 0;
+        for (quint64 m = n; m > 1; m >>= 1)
+            ++redDepth;
+    }
+
+    Node* node = BuildBalanced(nodes, 0, n, 0, redDepth, NIL);
+    if (node != NIL)
+        node->color = Color::BLACK;
+    return node;
+}
+
+Node* RedBlackTree::BuildBalanced(const std::vector<Node*>& nodes, quint64 begin, quint64 end,
+                                  quint32 depth, quint32 redDepth, Node* parent)
+{
+    if (begin >= end)
+        return NIL;
+
+    quint64 mid = begin + (end - begin) / 2;
+    Node* node = nodes[mid];
+
+    node->parent = parent;
+    node->color = depth == redDepth ? Color::RED : Color::BLACK;
+    node->left = BuildBalanced(nodes, begin, mid, depth + 1, redDepth, node);
+    node->right = BuildBalanced(nodes, mid + 1, end, depth + 1, redDepth, node);
+
+    PullUp(node);
+    return node;
+}
+
+bool RedBlackTree::Join(RedBlackTree& left, const QString& pivot, RedBlackTree& right)
+{
+    if (!CanJoin(left, right))
+        return false;
+
+    bool ok = true;
+    auto pivotData = ConvertValue(left.dataType, pivot, ok);
+    if (!ok)
+        return false;
+
+    left.Settle();
+    right.Settle();
 
-                auto zp = z->parent.lock();
-                auto zpp = zp->parent.lock();
+    bool isOrdered = std::visit([&left, &right](const auto& value) {
+        using Key = std::decay_t<decltype(value)>;
+        KeyCompare<Key> compare;
 
-                emit ChangeColorSignal(zp, Color::BLACK);
-                emit ChangeColorSignal(zpp, Color::RED);
+        const Node* max = Rightmost(left.root);
+        const Node* min = Leftmost(right.root);
+        return (max == NIL || !compare(value, max->GetData<Key>())) &&
+               (min == NIL || !compare(min->GetData<Key>(), value));
+    }, pivotData);
+
+    if (!isOrdered)
+    {
+        emit ErrorMessageSignal("The pivot must lie between the keys of the left and the right tree!");
+        return false;
+    }
 
-                zp->color = Color::BLACK;
-                zpp->color = Color::RED;
-                LeftRotate(zpp);
+    // A multiset keeps one node per key, a pivot equal to a boundary key only adds to
+    // the count of that node.
+    if (left.isMultiset)
+    {
+        for (RedBlackTree* tree : { &left, &right })
+        {
+            Node* boundary = const_cast<Node*>(tree == &left ? Rightmost(left.root) : Leftmost(right.root));
+            if (boundary != NIL && SameKey(boundary->data, pivotData))
+            {
+                ++boundary->count;
+                for (Node* node = boundary; node != NIL; node = node->parent)
+                    tree->PullUp(node);
+                return Join(left, right);
             }
         }
     }
 
-    emit ChangeColorSignal(root, Color::BLACK);
-    root->color = Color::BLACK;
+    // The pivot is allocated from the right tree's pool, which ends up in this tree anyway.
+    JoinTrees(left, right.pool->Create(pivotData, Color::RED), right);
+    return true;
+}
+
+bool RedBlackTree::Join(RedBlackTree& left, RedBlackTree& right)
+{
+    if (!CanJoin(left, right))
+        return false;
+
+    left.Settle();
+    right.Settle();
+
+    const Node* max = Rightmost(left.root);
+    Node* min = const_cast<Node*>(Leftmost(right.root));
+
+    if (max != NIL && min != NIL)
+    {
+        bool isOrdered = std::visit([min](const auto& value) {
+            using Key = std::decay_t<decltype(value)>;
+            return !KeyCompare<Key>()(min->GetData<Key>(), value);
+        }, max->data);
+
+        if (!isOrdered)
+        {
+            emit ErrorMessageSignal("Keys of the left tree must not be greater than keys of the right tree!");
+            return false;
+        }
+    }
+
+    // Equal boundary keys of multisets are merged into the node of the left tree.
+    if (left.isMultiset && max != NIL && min != NIL && SameKey(max->data, min->data))
+    {
+        Node* merged = const_cast<Node*>(max);
+        merged->count += min->count;
+        for (Node* node = merged; node != NIL; node = node->parent)
+            left.PullUp(node);
+
+        QSignalBlocker blocker(&right);
+        right.DeleteNode(min);
+        min = const_cast<Node*>(Leftmost(right.root));
+    }
+
+    // The smallest key of the right tree becomes the pivot.
+    if (min != NIL)
+    {
+        QSignalBlocker blocker(&right);
+        right.UnlinkNode(min);
+    }
+
+    JoinTrees(left, min != NIL ? min : nullptr, right);
+    return true;
+}
+
+bool RedBlackTree::Split(const QString& key, RedBlackTree& left, RedBlackTree& right)
+{
+    if (&left == &right)
+    {
+        emit ErrorMessageSignal("Split needs two different trees!");
+        return false;
+    }
+
+    bool ok = true;
+    auto keyData = ConvertValue(dataType, key, ok);
+    if (!ok)
+        return false;
+
+    Settle();
+
+    Node* node = std::exchange(root, NIL);
+    nodeCount = 0;
+
+    auto pieces = std::visit([this, node](const auto& value) {
+        using Key = std::decay_t<decltype(value)>;
+        return SplitNodes<Key>(node, BlackHeight(node), value);
+    }, keyData);
+
+    // Every half gets a pool of its own, so the halves can be modified from different
+    // threads. The lower one keeps the pool of this tree, the upper one a fork sharing
+    // its slabs, and this tree starts over with an empty pool.
+    auto lowerPool = std::exchange(pool, std::make_shared<NodePool>());
+    auto upperPool = lowerPool->Fork(pieces.second.node->size);
+
+    for (auto [tree, piece, treePool] : { std::tuple(&left, pieces.first, lowerPool), std::tuple(&right, pieces.second, upperPool) })
+    {
+        tree->ReleaseNodes();
+        tree->pool = treePool;
+        tree->root = piece.node;
+        tree->nodeCount = piece.node->size;
+        tree->dataType = dataType;
+        tree->isMultiset = isMultiset;
+        tree->aggregate = aggregate;
+        tree->hasPayloads = hasPayloads;
+        tree->isLazyDelete = isLazyDelete;
+        tree->compactionThreshold = compactionThreshold;
+        tree->isRelaxedBalance = isRelaxedBalance;
+        if (hashIndex && !tree->hashIndex)
+            tree->hashIndex = std::make_unique<QHash<NodeData, Node*>>();
+        tree->ResetCaches();
+        tree->UpdateHeight();
+        RBT_EMIT_FROM(tree, UpdateNodeCountSignal());
+    }
+
+    if (this != &left && this != &right)
+    {
+        ResetCaches();
+        UpdateHeight();
+        RBT_EMIT(UpdateNodeCountSignal());
+    }
+    return true;
+}
+
+template<typename Key, typename Compare>
+std::pair<RedBlackTree::Piece, RedBlackTree::Piece> RedBlackTree::SplitNodes(Node* node, quint32 blackHeight, const Key& key)
+{
+    if (node == NIL)
+        return { { NIL, 0 }, { NIL, 0 } };
+
+    quint32 childHeight = node->color == Color::BLACK ? blackHeight - 1 : blackHeight;
+    Piece left = Detach(node->left, childHeight);
+    Piece right = Detach(node->right, childHeight);
+
+    // Every level joins one subtree back with the node as pivot, the black heights of
+    // the joined pieces only grow along the path, so the whole split stays O(log n).
+    if (Compare()(node->GetData<Key>(), key))
+    {
+        auto [lower, upper] = SplitNodes<Key, Compare>(right.node, right.blackHeight, key);
+        return { JoinNodes(left, node, lower), upper };
+    }
+
+    auto [lower, upper] = SplitNodes<Key, Compare>(left.node, left.blackHeight, key);
+    return { lower, JoinNodes(upper, node, right) };
 }
 
-void RedBlackTree::Transplant(std::shared_ptr<Node> u, std::shared_ptr<Node> v)
+bool RedBlackTree::CanJoin(const RedBlackTree& left, const RedBlackTree& right)
 {
-    auto up = u->parent.lock();
-    if (up == NIL)
+    if (&left == &right)
+    {
+        emit ErrorMessageSignal("The operation needs two different trees!");
+        return false;
+    }
+
+    if (left.dataType != right.dataType)
+    {
+        emit ErrorMessageSignal("Trees must have the same data type!");
+        return false;
+    }
+
+    if (left.isMultiset != right.isMultiset)
     {
-        emit TransplantSignal(v, root, true, true);
-        root = v;
+        emit ErrorMessageSignal("Both trees must be multisets or neither!");
+        return false;
     }
-    else if (u == up->left)
+    return true;
+}
+
+void RedBlackTree::JoinTrees(RedBlackTree& left, Node* pivot, RedBlackTree& right)
+{
+    // Either tree may be this one, taking their pools out keeps their nodes alive while
+    // the old contents are released.
+    auto leftPool = std::exchange(left.pool, std::make_shared<NodePool>());
+    auto rightPool = std::exchange(right.pool, std::make_shared<NodePool>());
+
+    Piece lower = { std::exchange(left.root, NIL), 0 };
+    Piece upper = { std::exchange(right.root, NIL), 0 };
+    lower.blackHeight = BlackHeight(lower.node);
+    upper.blackHeight = BlackHeight(upper.node);
+    left.nodeCount = right.nodeCount = 0;
+
+    dataType = left.dataType;
+    isMultiset = left.isMultiset;
+    hasPayloads = hasPayloads || left.hasPayloads || right.hasPayloads;
+    ReleaseNodes();
+    nodeCount = 0;
+
+    pool->Absorb(*leftPool);
+    pool->Absorb(*rightPool);
+
+    if (pivot)
+        root = JoinNodes(lower, pivot, upper).node;
+    else
+        root = lower.node != NIL ? lower.node : upper.node;
+
+    nodeCount = root->size;
+    ResetCaches();
+
+    for (RedBlackTree* tree : { &left, &right })
     {
-        emit TransplantSignal(v, up, true);
-        up->left = v;
+        if (tree != this)
+        {
+            tree->ResetCaches();
+            tree->UpdateHeight();
+            RBT_EMIT_FROM(tree, UpdateNodeCountSignal());
+        }
     }
+
+    UpdateHeight();
+    RBT_EMIT(UpdateNodeCountSignal());
+}
+
+RedBlackTree::Piece RedBlackTree::JoinNodes(Piece left, Node* pivot, Piece right)
+{
+    Node* node;
+
+    if (left.blackHeight > right.blackHeight)
+        node = JoinRight(left.node, left.blackHeight, pivot, right.node, right.blackHeight);
+    else if (left.blackHeight < right.blackHeight)
+        node = JoinLeft(right.node, right.blackHeight, pivot, left.node, left.blackHeight);
     else
     {
-        emit TransplantSignal(v, up, false);
-        up->right = v;
+        pivot->color = Color::RED;
+        pivot->left = left.node;
+        pivot->right = right.node;
+        if (left.node != NIL)
+            left.node->parent = pivot;
+        if (right.node != NIL)
+            right.node->parent = pivot;
+        PullUp(pivot);
+        node = pivot;
+    }
+
+    // A red root, possibly with a red child, is blackened and adds one to the black height.
+    quint32 blackHeight = std::max(left.blackHeight, right.blackHeight);
+    if (node->color == Color::RED)
+    {
+        node->color = Color::BLACK;
+        ++blackHeight;
+    }
+
+    node->parent = NIL;
+    return { node, blackHeight };
+}
+
+Node* RedBlackTree::JoinRight(Node* left, quint32 leftHeight, Node* pivot, Node* right, quint32 rightHeight)
+{
+    // Walk down the right spine of the higher tree to a black node of the same black
+    // height and hang the pivot in its place as a red node.
+    if (left->color == Color::BLACK && leftHeight == rightHeight)
+    {
+        pivot->color = Color::RED;
+        pivot->left = left;
+        pivot->right = right;
+        if (left != NIL)
+            left->parent = pivot;
+        if (right != NIL)
+            right->parent = pivot;
+        PullUp(pivot);
+        return pivot;
+    }
+
+    Node* child = JoinRight(left->right, left->color == Color::BLACK ? leftHeight - 1 : leftHeight,
+                            pivot, right, rightHeight);
+    left->right = child;
+    child->parent = left;
+
+    // Two reds in a row below a black node are fixed by one rotation, the red subtree
+    // root it leaves is handled by the next black node up or blackened by JoinNodes.
+    if (left->color == Color::BLACK && child->color == Color::RED && child->right->color == Color::RED)
+    {
+        child->right->color = Color::BLACK;
+        return RotateLeftLocal(left);
     }
 
-    emit ChangeParentSignal(v, up);
-    v->parent = up;
+    PullUp(left);
+    return left;
+}
+
+Node* RedBlackTree::JoinLeft(Node* right, quint32 rightHeight, Node* pivot, Node* left, quint32 leftHeight)
+{
+    if (right->color == Color::BLACK && rightHeight == leftHeight)
+    {
+        pivot->color = Color::RED;
+        pivot->left = left;
+        pivot->right = right;
+        if (left != NIL)
+            left->parent = pivot;
+        if (right != NIL)
+            right->parent = pivot;
+        PullUp(pivot);
+        return pivot;
+    }
+
+    Node* child = JoinLeft(right->left, right->color == Color::BLACK ? rightHeight - 1 : rightHeight,
+                           pivot, left, leftHeight);
+    right->left = child;
+    child->parent = right;
+
+    if (right->color == Color::BLACK && child->color == Color::RED && child->left->color == Color::RED)
+    {
+        child->left->color = Color::BLACK;
+        return RotateRightLocal(right);
+    }
+
+    PullUp(right);
+    return right;
+}
+
+Node* RedBlackTree::RotateLeftLocal(Node* x)
+{
+    Node* y = x->right;
+
+    x->right = y->left;
+    if (y->left != NIL)
+        y->left->parent = x;
+
+    y->parent = x->parent;
+    y->left = x;
+    x->parent = y;
+
+    PullUp(x);
+    PullUp(y);
+    return y;
+}
+
+Node* RedBlackTree::RotateRightLocal(Node* x)
+{
+    Node* y = x->left;
+
+    x->left = y->right;
+    if (y->right != NIL)
+        y->right->parent = x;
+
+    y->parent = x->parent;
+    y->right = x;
+    x->parent = y;
+
+    PullUp(x);
+    PullUp(y);
+    return y;
+}
+
+quint32 RedBlackTree::BlackHeight(const Node* node)
+{
+    quint32 blackHeight = 0;
+    for (; node != NIL; node = node->left)
+    {
+        if (node->color == Color::BLACK)
+            ++blackHeight;
+    }
+    return blackHeight;
+}
+
+RedBlackTree::Piece RedBlackTree::Detach(Node* node, quint32 blackHeight)
+{
+    if (node == NIL)
+        return { NIL, 0 };
+
+    // Blackening a red subtree root keeps it a valid tree one black level higher.
+    node->parent = NIL;
+    if (node->color == Color::RED)
+    {
+        node->color = Color::BLACK;
+        ++blackHeight;
+    }
+    return { node, blackHeight };
+}
+
+RedBlackTree::Piece RedBlackTree::JoinPieces(Piece left, Piece right)
+{
+    if (left.node == NIL)
+        return right;
+    if (right.node == NIL)
+        return left;
+
+    Node* last;
+    Piece rest = SplitLast(left, last);
+    return JoinNodes(rest, last, right);
+}
+
+RedBlackTree::Piece RedBlackTree::SplitLast(Piece tree, Node*& last)
+{
+    Node* node = tree.node;
+    quint32 childHeight = node->color == Color::BLACK ? tree.blackHeight - 1 : tree.blackHeight;
+    Piece left = Detach(node->left, childHeight);
+    Piece right = Detach(node->right, childHeight);
+
+    if (right.node == NIL)
+    {
+        last = node;
+        return left;
+    }
+
+    Piece rest = SplitLast(right, last);
+    return JoinNodes(left, node, rest);
+}
+
+bool RedBlackTree::Union(RedBlackTree& other)
+{
+    return ApplySetOperation(other, SetOperation::UNION);
+}
+
+bool RedBlackTree::Intersection(RedBlackTree& other)
+{
+    return ApplySetOperation(other, SetOperation::INTERSECTION);
+}
+
+bool RedBlackTree::Difference(RedBlackTree& other)
+{
+    return ApplySetOperation(other, SetOperation::DIFFERENCE);
+}
+
+bool RedBlackTree::ApplySetOperation(RedBlackTree& other, SetOperation operation)
+{
+    if (!CanJoin(*this, other))
+        return false;
+
+    Settle();
+    other.Settle();
+
+    Piece first = { std::exchange(root, NIL), 0 };
+    Piece second = { std::exchange(other.root, NIL), 0 };
+    first.blackHeight = BlackHeight(first.node);
+    second.blackHeight = BlackHeight(second.node);
+    nodeCount = other.nodeCount = 0;
+
+    pool->Absorb(*other.pool);
+
+    std::vector<Node*> removed;
+    Piece result = { NIL, 0 };
+
+    if (Node* node = first.node != NIL ? first.node : second.node; node != NIL)
+    {
+        result = std::visit([this, first, second, operation, &removed](const auto& value) {
+            using Key = std::decay_t<decltype(value)>;
+            return SetOperationNodes<Key>(first, second, operation, removed);
+        }, node->data);
+    }
+
+    root = result.node;
+    nodeCount = root->size;
+    ResetCaches();
+
+    for (Node* node : removed)
+        DestroyTree(node);
+
+    other.ResetCaches();
+    other.UpdateHeight();
+    RBT_EMIT_FROM(&other, UpdateNodeCountSignal());
+
+    UpdateHeight();
+    RBT_EMIT(UpdateNodeCountSignal());
+    return true;
+}
+
+template<typename Key, typename Compare>
+RedBlackTree::Piece RedBlackTree::SetOperationNodes(Piece first, Piece second, SetOperation operation, std::vector<Node*>& removed)
+{
+    if (first.node == NIL || second.node == NIL)
+    {
+        Piece kept = { NIL, 0 };
+        if (operation == SetOperation::UNION)
+            kept = first.node != NIL ? first : second;
+        else if (operation == SetOperation::DIFFERENCE)
+            kept = first;
+
+        for (const Piece& piece : { first, second })
+        {
+            if (piece.node != NIL && piece.node != kept.node)
+                removed.push_back(piece.node);
+        }
+        return kept;
+    }
+
+    // The root of the second tree splits the first one into the keys below it, the
+    // keys equal to it and the keys above it.
+    Node* pivot = second.node;
+    quint32 childHeight = pivot->color == Color::BLACK ? second.blackHeight - 1 : second.blackHeight;
+    Piece secondLeft = Detach(pivot->left, childHeight);
+    Piece secondRight = Detach(pivot->right, childHeight);
+
+    const Key& key = pivot->GetData<Key>();
+    auto [lower, rest] = SplitNodes<Key, Compare>(first.node, first.blackHeight, key);
+    auto [equal, upper] = SplitNodes<Key, KeyNotGreater<Key, Compare>>(rest.node, rest.blackHeight, key);
+
+    Piece left, right;
+    std::vector<Node*> rightRemoved;
+
+    quint64 leftSize = lower.node->size + secondLeft.node->size;
+    quint64 rightSize = upper.node->size + secondRight.node->size;
+
+    ParallelInvoke([&] { left = SetOperationNodes<Key, Compare>(lower, secondLeft, operation, removed); },
+                   [&] { right = SetOperationNodes<Key, Compare>(upper, secondRight, operation, rightRemoved); },
+                   std::min(leftSize, rightSize) >= PARALLEL_GRAIN);
+
+    removed.insert(removed.end(), rightRemoved.begin(), rightRemoved.end());
+
+    // Multisets add the copies of both trees in a union, keep the smaller count in an
+    // intersection and the surplus of the first tree in a difference.
+    quint32 firstCount = equal.node != NIL ? equal.node->count : 0;
+    Node* kept = nullptr;
+
+    if (operation == SetOperation::UNION)
+    {
+        kept = pivot;
+        if (isMultiset)
+            pivot->count += firstCount;
+    }
+    else if (operation == SetOperation::INTERSECTION && firstCount > 0)
+    {
+        kept = pivot;
+        if (isMultiset)
+            pivot->count = std::min(pivot->count, firstCount);
+    }
+    else if (operation == SetOperation::DIFFERENCE && isMultiset && firstCount > pivot->count)
+    {
+        kept = equal.node;
+        equal.node->count = firstCount - pivot->count;
+    }
+
+    if (equal.node != NIL && equal.node != kept)
+        removed.push_back(equal.node);
+
+    if (pivot != kept)
+    {
+        // The pivot goes away on its own, its children live on in left and right.
+        pivot->left = pivot->right = NIL;
+        removed.push_back(pivot);
+    }
+
+    return kept ? JoinNodes(left, kept, right) : JoinPieces(left, right);
+}
+
+void RedBlackTree::ParallelInvoke(const std::function<void()>& first, const std::function<void()>& second, bool parallel)
+{
+    // tryStart only succeeds with an idle thread, so waiting here can never block on a
+    // task that has not been started yet.
+    QSemaphore done;
+    if (parallel && QThreadPool::globalInstance()->tryStart([&first, &done] {
+            first();
+            done.release();
+        }))
+    {
+        second();
+        done.acquire();
+        return;
+    }
+
+    first();
+    second();
+}
+
+void RedBlackTree::PullUp(Node* node)
+{
+    if (node == NIL)
+        return;
+
+    node->size = (node->IsTombstone() ? 0 : 1) + node->left->size + node->right->size;
+
+    // NIL is shared by all trees, so its aggregate can't hold the identity of this one.
+    if (aggregate.IsSet())
+    {
+        qint64 value = MapNode(*node);
+        if (node->left != NIL)
+            value = aggregate.combine(node->left->aggregate, value);
+        if (node->right != NIL)
+            value = aggregate.combine(value, node->right->aggregate);
+        node->aggregate = value;
+    }
+
+    // A tombstone must not steer the overlap searches into its subtree.
+    if (dataType == DataType::INTERVAL)
+    {
+        qint16 maxHigh = node->IsTombstone() ? std::numeric_limits<qint16>::min() : node->GetData<Interval>().high;
+        if (node->left != NIL)
+            maxHigh = std::max(maxHigh, node->left->maxHigh);
+        if (node->right != NIL)
+            maxHigh = std::max(maxHigh, node->right->maxHigh);
+        node->maxHigh = maxHigh;
+    }
+}
+
+bool RedBlackTree::ConvertInterval(const QString& intervalStr, Interval& interval)
+{
+    if (dataType != DataType::INTERVAL)
+    {
+        emit ErrorMessageSignal("Interval queries need a tree of intervals!");
+        return false;
+    }
+
+    bool ok = true;
+    auto data = ConvertValue(DataType::INTERVAL, intervalStr, ok);
+    if (ok)
+        interval = std::get<Interval>(data);
+    return ok;
+}
+
+const Node* RedBlackTree::FindOverlap(const QString& intervalStr)
+{
+    Interval interval;
+    if (!ConvertInterval(intervalStr, interval))
+        return NIL;
+
+    const Node* x = root;
+
+    // If the left subtree reaches interval.low but holds no overlap, every interval
+    // there starts after interval.high and so does everything to the right.
+    while (x != NIL && (x->IsTombstone() || !x->GetData<Interval>().Overlaps(interval)))
+    {
+        if (x->left != NIL && x->left->maxHigh >= interval.low)
+            x = x->left;
+        else
+            x = x->right;
+    }
+    return x;
+}
+
+QList<const Node*> RedBlackTree::FindAllOverlaps(const QString& intervalStr)
+{
+    QList<const Node*> result;
+    Interval interval;
+
+    if (ConvertInterval(intervalStr, interval))
+        CollectOverlaps(root, interval, result);
+    return result;
+}
+
+QList<const Node*> RedBlackTree::Stab(const QString& point)
+{
+    return FindAllOverlaps(QString("[%1,%1]").arg(point.trimmed()));
+}
+
+void RedBlackTree::CollectOverlaps(const Node* node, const Interval& interval, QList<const Node*>& result) const
+{
+    if (node == NIL || node->maxHigh < interval.low)
+        return;
+
+    CollectOverlaps(node->left, interval, result);
+
+    // Intervals are ordered by their low endpoint, nothing from here on can start in time.
+    const Interval& key = node->GetData<Interval>();
+    if (key.low > interval.high)
+        return;
+
+    if (!node->IsTombstone() && key.Overlaps(interval))
+        result.append(node);
+
+    CollectOverlaps(node->right, interval, result);
+}
+
+void RedBlackTree::SetAggregate(const Aggregate& aggregate)
+{
+    this->aggregate = aggregate;
+    PullUpSubtree(root);
+}
+
+qint64 RedBlackTree::RangeAggregate(const QString& lo, const QString& hi)
+{
+    if (!aggregate.IsSet())
+        return 0;
+
+    bool ok = true;
+    auto loData = ConvertValue(dataType, lo, ok);
+    if (!ok)
+        return aggregate.identity;
+    auto hiData = ConvertValue(dataType, hi, ok);
+    if (!ok)
+        return aggregate.identity;
+
+    return std::visit([this, &hiData](const auto& value) {
+        using Key = std::decay_t<decltype(value)>;
+        return RangeAggregate<Key>(value, std::get<Key>(hiData));
+    }, loData);
+}
+
+template<typename Key, typename Compare>
+qint64 RedBlackTree::RangeAggregate(const Key& lo, const Key& hi) const
+{
+    Compare compare;
+    const Node* x = root;
+
+    // The first node inside the range splits it, its left subtree only has to be
+    // bounded from below and its right subtree only from above.
+    while (x != NIL)
+    {
+        const Key& nodeKey = x->GetData<Key>();
+
+        if (compare(nodeKey, lo))
+            x = x->right;
+        else if (compare(hi, nodeKey))
+            x = x->left;
+        else
+            break;
+    }
+
+    if (x == NIL)
+        return aggregate.identity;
+
+    qint64 value = AggregateFrom<Key, Compare>(x->left, lo);
+    value = aggregate.combine(value, MapNode(*x));
+    return aggregate.combine(value, AggregateUpTo<Key, Compare>(x->right, hi));
+}
+
+// Aggregate of the keys in the subtree that are not smaller than lo.
+template<typename Key, typename Compare>
+qint64 RedBlackTree::AggregateFrom(const Node* node, const Key& lo) const
+{
+    if (node == NIL)
+        return aggregate.identity;
+
+    if (Compare()(node->GetData<Key>(), lo))
+        return AggregateFrom<Key, Compare>(node->right, lo);
+
+    qint64 value = aggregate.combine(AggregateFrom<Key, Compare>(node->left, lo), MapNode(*node));
+    return node->right != NIL ? aggregate.combine(value, node->right->aggregate) : value;
+}
+
+// Aggregate of the keys in the subtree that are not greater than hi.
+template<typename Key, typename Compare>
+qint64 RedBlackTree::AggregateUpTo(const Node* node, const Key& hi) const
+{
+    if (node == NIL)
+        return aggregate.identity;
+
+    if (Compare()(hi, node->GetData<Key>()))
+        return AggregateUpTo<Key, Compare>(node->left, hi);
+
+    qint64 value = aggregate.combine(MapNode(*node), AggregateUpTo<Key, Compare>(node->right, hi));
+    return node->left != NIL ? aggregate.combine(node->left->aggregate, value) : value;
+}
+
+qint64 RedBlackTree::MapNode(const Node& node) const
+{
+    return node.IsTombstone() ? aggregate.identity : aggregate.map(node);
+}
+
+RedBlackTree::InsertResult RedBlackTree::Insert(const QString& key)
+{
+    bool ok = true;
+    auto data = ConvertValue(dataType, key, ok);
+    if (!ok)
+        return {};
+
+    return std::visit([this, &key](const auto& value) {
+        using Key = std::decay_t<decltype(value)>;
+        return Insert<Key>(value, key);
+    }, data);
+}
+
+RedBlackTree::InsertResult RedBlackTree::Insert(qint16 key)
+{
+    if (!IsValidKey(DataType::NUMBER, 1, key))
+        return {};
+    return Insert<qint16>(key, QString());
+}
+
+RedBlackTree::InsertResult RedBlackTree::Insert(QChar key)
+{
+    if (!IsValidKey(DataType::CHAR))
+        return {};
+    return Insert<QChar>(key, QString());
+}
+
+RedBlackTree::InsertResult RedBlackTree::Insert(QStringView key)
+{
+    if (!IsValidKey(DataType::TEXT, key.size()))
+        return {};
+    return Insert<QString>(key.toString(), QString());
+}
+
+RedBlackTree::InsertResult RedBlackTree::Insert(QLatin1StringView key)
+{
+    if (!IsValidKey(DataType::TEXT, key.size()))
+        return {};
+    return Insert<QString>(QString(key), QString());
+}
+
+RedBlackTree::InsertResult RedBlackTree::InsertHinted(const Node* hint, const QString& key)
+{
+    bool ok = true;
+    auto data = ConvertValue(dataType, key, ok);
+    if (!ok)
+        return {};
+
+    return std::visit([this, hint, &key](const auto& value) {
+        using Key = std::decay_t<decltype(value)>;
+        return InsertHinted<Key>(const_cast<Node*>(hint), value, key);
+    }, data);
+}
+
+template<typename Key, typename Compare>
+RedBlackTree::InsertResult RedBlackTree::InsertHinted(Node* hint, const Key& key, const QString& keyStr)
+{
+    Compare compare;
+    Node* x = hint != NIL ? hint : root;
+
+    // Climb until the insertion point lies inside the subtree of x. A left child is
+    // bounded above by its parent and a right child below, so only the side towards
+    // key has to be checked.
+    if (x != NIL)
+    {
+        bool isAbove = !compare(key, x->GetData<Key>());
+        for (Node* parent = x->parent; parent != NIL; x = parent, parent = parent->parent)
+        {
+            const Key& parentKey = parent->GetData<Key>();
+            if (isAbove && x == parent->left && compare(key, parentKey))
+                break;
+            if (!isAbove && x == parent->right && !compare(key, parentKey))
+            {
+                // An equal lower bound is the node a multiset adds the copy to.
+                if (isMultiset && !compare(parentKey, key))
+                    x = parent;
+                break;
+            }
+        }
+    }
+
+    Node* y = NIL;
+    bool isLeft = true;
+
+    while (x != NIL)
+    {
+        const Key& nodeKey = x->GetData<Key>();
+        if (isMultiset && !compare(key, nodeKey) && !compare(nodeKey, key))
+        {
+            RBT_EMIT(HighlightNodeSignal(x, QColor(Qt::green)));
+            if (x->IsTombstone())
+                Revive(x);
+            else
+                ++x->count;
+            return { x, 0 };
+        }
+
+        y = x;
+        isLeft = compare(key, nodeKey);
+        RBT_EMIT(HighlightNodeSignal(x, Qt::blue, isLeft, keyStr));
+        x = isLeft ? x->left : x->right;
+    }
+
+    Node* z = pool->Create(key, Color::RED);
+    RBT_EMIT(CreateNodeSignal(z));
+
+    return { z, LinkNode(z, y, isLeft) };
+}
+
+quint32 RedBlackTree::LinkNode(Node* z, Node* y, bool isLeft)
+{
+    z->parent = y;
+    z->left = NIL;
+    z->right = NIL;
+
+    if (y == NIL)
+    {
+        RBT_EMIT(MoveNodeSignal(z, root, true, true));
+        root = z;
+    }
+    else
+    {
+        RBT_EMIT(MoveNodeSignal(z, y, isLeft));
+        (isLeft ? y->left : y->right) = z;
+    }
+    CacheLinked(z);
+
+    // Nothing was counted on the way down, the path from z to the root is recounted
+    // instead, z included for its aggregate.
+    quint32 depth = 0;
+    for (Node* node = z; node != NIL; node = node->parent, ++depth)
+        PullUp(node);
+
+    if (isRelaxedBalance)
+        pendingFixups.push_back(z);
+    else
+        Engine::InsertFixup(*this, z);
+
+    ++nodeCount;
+    UpdateHeight();
+    RBT_EMIT(UpdateNodeCountSignal());
+    return depth;
+}
+
+// A hinted insert without a hint descends from the root, so both share the descent
+// and LinkNode.
+template<typename Key, typename Compare>
+RedBlackTree::InsertResult RedBlackTree::Insert(const Key& key, const QString& keyStr)
+{
+    return InsertHinted<Key, Compare>(NIL, key, keyStr);
+}
+
+
+Node* RedBlackTree::Minimum(Node* node)
+{
+    auto x = node;
+    while (node->left != NIL)
+    {
+        RBT_EMIT(HighlightNodeSignal(x, Qt::yellow, false, "min"));
+        node = node->left;
+    }
+    RBT_EMIT(HighlightNodeSignal(node, Qt::yellow, false));
+    return node;
+}
+
+
+bool RedBlackTree::Delete(const QString &key)
+{
+    bool ok = true;
+    auto data = ConvertValue(dataType, key, ok);
+    if (!ok)
+        return false;
+
+    return std::visit([this, &key](const auto& value) {
+        using Key = std::decay_t<decltype(value)>;
+        return Delete<Key>(value, key);
+    }, data);
+}
+
+bool RedBlackTree::Delete(qint16 key)
+{
+    return IsValidKey(DataType::NUMBER, 1, key) && Delete<qint16>(key, QString());
+}
+
+bool RedBlackTree::Delete(QChar key)
+{
+    return IsValidKey(DataType::CHAR) && Delete<QChar>(key, QString());
+}
+
+bool RedBlackTree::Delete(QStringView key)
+{
+    return IsValidKey(DataType::TEXT, key.size()) && Delete<QString>(key, QString());
 }
 
+bool RedBlackTree::Delete(QLatin1StringView key)
+{
+    if (!IsValidKey(DataType::TEXT, key.size()))
+        return false;
+
+    // Latin-1 maps to UTF-16 one to one and a valid key fits on the stack.
+    QChar buffer[MAX_LENGTH];
+    for (qsizetype i = 0; i < key.size(); ++i)
+        buffer[i] = key.at(i);
+
+    return Delete<QString>(QStringView(buffer, key.size()), QString());
+}
 
-std::shared_ptr<Node> RedBlackTree::Minimum(std::shared_ptr<Node> node)
+template<typename Key, typename Compare, typename Lookup>
+bool RedBlackTree::Delete(const Lookup& key, const QString& keyStr)
 {
-    auto x = node;
-    while (node->left != NIL)
+    Compare compare;
+
+    if (isLazyDelete)
     {
-        emit HighlightNodeSignal(x, Qt::yellow, false, "min");
-        node = node->left;
-    }
-    emit HighlightNodeSignal(node, Qt::yellow, false);
-    return node;
-}
+        Node* z = const_cast<Node*>(LowerBound<Key, Compare>(key));
+        if (z == NIL || !(z->GetData<Key>() == key))
+        {
+            emit ErrorMessageSignal("Key was not found in the tree!");
+            return false;
+        }
 
+        RBT_EMIT(HighlightNodeSignal(z, QColor(Qt::magenta)));
+        if (isMultiset && z->count > 1)
+            --z->count;
+        else
+            Bury(z);
+        return true;
+    }
 
-bool RedBlackTree::Delete(const QString &key)
-{
     auto z = NIL;
     auto node = root;
 
-    bool ok = true;
-    auto data = ConvertValue(dataType, key, ok);
-    if (!ok)
-        return false;
-
     while (node != NIL)
     {
-        if (node->data == data)
+        const Key& nodeKey = node->GetData<Key>();
+        bool isEqual = nodeKey == key;
+
+        if (isEqual)
             z = node;
 
-        if (node->CompareData(data) || node->data == data)
+        if (isEqual || compare(nodeKey, key))
         {
-            emit HighlightNodeSignal(node, Qt::blue, false, key);
+            RBT_EMIT(HighlightNodeSignal(node, Qt::blue, false, keyStr));
             node = node->right;
         }
         else
         {
-            emit HighlightNodeSignal(node, Qt::blue, true, key);
+            RBT_EMIT(HighlightNodeSignal(node, Qt::blue, true, keyStr));
             node = node->left;
         }
     }
@@ -466,192 +2129,156 @@ bool RedBlackTree::Delete(const QString &key)
         return false;
     }
     else
-        emit HighlightNodeSignal(z, QColor(Qt::magenta));
-
-    std::shared_ptr<Node> x, y;
+        RBT_EMIT(HighlightNodeSignal(z, QColor(Qt::magenta)));
 
-    y = z;
-    Color y_original_color = y->color;
-
-    if (z->left == NIL)
-    {
-        x = z->right;
-        Transplant(z, z->right);
-    }
-    else if (z->right == NIL)
+    if (isMultiset && z->count > 1)
     {
-        x = z->left;
-        Transplant(z, z->left);
+        --z->count;
+        return true;
     }
-    else
-    {
-        y = Minimum(z->right);
-        y_original_color = y->color;
-        x = y->right;
-        if (y != z->right)
-        {
-            Transplant(y, y->right);
 
-            emit ChangeSiblingSignal(y, z->right, false);
-            emit ChangeParentSignal(y->right, y);
+    DeleteNode(z);
 
-            y->right = z->right;
-            y->right->parent = y;
-        }
-        else
-        {
-            emit ChangeParentSignal(x, y);
-            x->parent = y;    
-        }
+    UpdateHeight();
+    RBT_EMIT(UpdateNodeCountSignal());
 
-        Transplant(z, y);
+    return true;
+}
 
-        emit ChangeSiblingSignal(y, z->left, true);
-        emit ChangeParentSignal(y->left, y);
-        emit ChangeColorSignal(y, z->color);
+void RedBlackTree::DeleteNode(Node* z)
+{
+    UnlinkNode(z);
+    pool->Destroy(z);
+}
 
-        y->left = z->left;
-        y->left->parent = y;
-        y->color = z->color;
-    }
+void RedBlackTree::UnlinkNode(Node* z)
+{
+    // DeleteFixup relies on a valid tree.
+    Rebalance();
+    CacheUnlinked(z);
 
-    emit DeleteSignal(z);
+    Engine::Unlink(*this, z);
+    --nodeCount;
+}
 
-    if (y_original_color == Color::BLACK)
-        DeleteFixup(x);
+quint64 RedBlackTree::Count(const QString& key)
+{
+    bool ok = true;
+    auto data = ConvertValue(dataType, key, ok);
+    if (!ok)
+        return 0;
 
-    UpdateHeight();
-    UpdateNodeCount();
+    return std::visit([this](const auto& value) -> quint64 {
+        using Key = std::decay_t<decltype(value)>;
+        if (!isMultiset)
+            return CountBelow<Key>(value, true) - CountBelow<Key>(value, false);
 
-    return true;
+        const_iterator it = lower_bound<Key>(value);
+        return it != end() && !KeyCompare<Key>()(value, it->GetData<Key>()) ? it->count : 0;
+    }, data);
 }
 
-void RedBlackTree::DeleteFixup(std::shared_ptr<Node> x)
+bool RedBlackTree::SetMultiset(bool enabled)
 {
-    std::shared_ptr<Node> w;
-    while (x != root && x->color == Color::BLACK)
+    if (root != NIL)
     {
-        auto xp = x->parent.lock();
-
-        if (x == xp->left)
-        {
-            w = xp->right;
-            if (w->color == Color::RED)
-            {
-                emit ChangeColorSignal(w, Color::BLACK);
-                emit ChangeColorSignal(xp, Color::RED);
+        emit ErrorMessageSignal("The multiset mode can only be changed on an empty tree!");
+        return false;
+    }
 
-                w->color = Color::BLACK;
-                xp->color = Color::RED;
-                LeftRotate(xp);
-                w = xp->right;
-            }
-            if (w->left->color == Color::BLACK &&
-                w->right->color == Color::BLACK)
-            {
-                emit ChangeColorSignal(w, Color::RED);
+    isMultiset = enabled;
+    return true;
+}
 
-                w->color = Color::RED;
-                x = xp;
-            }
-            else
-            {
-                if (w->right->color == Color::BLACK)
-                {
-                    emit ChangeColorSignal(w->left, Color::BLACK);
-                    emit ChangeColorSignal(w, Color::RED);
+bool RedBlackTree::SameKey(const NodeData& a, const NodeData& b)
+{
+    return std::visit([&b](const auto& value) {
+        using Key = std::decay_t<decltype(value)>;
+        KeyCompare<Key> compare;
+        return !compare(value, std::get<Key>(b)) && !compare(std::get<Key>(b), value);
+    }, a);
+}
 
-                    w->left->color = Color::BLACK;
-                    w->color = Color::RED;
-                    RightRotate(w);
-                    w = xp->right;
-                }
-                emit ChangeColorSignal(w, xp->color);
-                emit ChangeColorSignal(xp, Color::BLACK);
-                emit ChangeColorSignal(w->right, Color::BLACK);
-
-                w->color = xp->color;
-                xp->color = Color::BLACK;
-                w->right->color = Color::BLACK;
-                LeftRotate(xp);
-                x = root;
-            }
-        }
-        else
-        {
-            w = xp->left;
-            if (w->color == Color::RED)
-            {
-                emit ChangeColorSignal(w, Color::BLACK);
-                emit ChangeColorSignal(xp, Color::RED);
+bool RedBlackTree::Find(const QString &key)
+{
+    bool ok = true;
+    auto data = ConvertValue(dataType, key, ok);
+    if (!ok)
+        return false;
 
-                w->color = Color::BLACK;
-                xp->color = Color::RED;
-                RightRotate(xp);
-                w = xp->left;
-            }
-            if (w->right->color == Color::BLACK &&
-                w->left->color == Color::BLACK)
-            {
-                emit ChangeColorSignal(w, Color::RED);
+    if (hashIndex)
+        return FindIndexed(data);
 
-                w->color = Color::RED;
-                x = xp;
-            }
-            else
-            {
-                if (w->left->color == Color::BLACK)
-                {
-                    emit ChangeColorSignal(w->right, Color::BLACK);
-                    emit ChangeColorSignal(w, Color::RED);
+    return std::visit([this, &key](const auto& value) {
+        using Key = std::decay_t<decltype(value)>;
+        return Find<Key>(value, key);
+    }, data);
+}
 
-                    w->right->color = Color::BLACK;
-                    w->color = Color::RED;
-                    LeftRotate(w);
-                    w = xp->left;
-                }
-                emit ChangeColorSignal(w, xp->color);
-                emit ChangeColorSignal(xp, Color::BLACK);
-                emit ChangeColorSignal(w->left, Color::BLACK);
-
-                w->color = xp->color;
-                xp->color = Color::BLACK;
-                w->left->color = Color::BLACK;
-                RightRotate(xp);
-                x = root;
-            }
-        }
-    }
+bool RedBlackTree::Find(qint16 key)
+{
+    if (!IsValidKey(DataType::NUMBER, 1, key))
+        return false;
+    return hashIndex ? FindIndexed(key) : Find<qint16>(key, QString());
+}
 
-    emit ChangeColorSignal(x, Color::BLACK);
-    x->color = Color::BLACK;
+bool RedBlackTree::Find(QChar key)
+{
+    if (!IsValidKey(DataType::CHAR))
+        return false;
+    return hashIndex ? FindIndexed(key) : Find<QChar>(key, QString());
 }
 
-bool RedBlackTree::Find(const QString &key)
+bool RedBlackTree::Find(QStringView key)
 {
-    auto node = root;
+    return IsValidKey(DataType::TEXT, key.size()) && Find<QString>(key, QString());
+}
 
-    bool ok = true;
-    auto data = ConvertValue(dataType, key, ok);
-    if (!ok)
+bool RedBlackTree::Find(QLatin1StringView key)
+{
+    if (!IsValidKey(DataType::TEXT, key.size()))
         return false;
 
+    QChar buffer[MAX_LENGTH];
+    for (qsizetype i = 0; i < key.size(); ++i)
+        buffer[i] = key.at(i);
+
+    return Find<QString>(QStringView(buffer, key.size()), QString());
+}
+
+template<typename Key, typename Compare, typename Lookup>
+bool RedBlackTree::Find(const Lookup& key, const QString& keyStr)
+{
+    Compare compare;
+    auto node = root;
+
     while (node != NIL)
     {
-        if (node->data == data)
+        const Key& nodeKey = node->GetData<Key>();
+
+        if (nodeKey == key)
         {
-            emit HighlightNodeSignal(node, QColor(Qt::green));
+            // Equal keys may sit on both sides of a tombstone, the first live one is
+            // searched for instead.
+            if (node->IsTombstone())
+            {
+                node = const_cast<Node*>(LowerBound<Key, Compare>(key));
+                if (node == NIL || !(node->GetData<Key>() == key))
+                    return false;
+            }
+
+            RBT_EMIT(HighlightNodeSignal(node, QColor(Qt::green)));
             return true;
         }
 
-        if (node->CompareData(data))
+        if (compare(nodeKey, key))
         {
-            emit HighlightNodeSignal(node, Qt::blue, false, key);
+            RBT_EMIT(HighlightNodeSignal(node, Qt::blue, false, keyStr));
             node = node->right;
         }
         else
         {
-            emit HighlightNodeSignal(node, Qt::blue, true, key);
+            RBT_EMIT(HighlightNodeSignal(node, Qt::blue, true, keyStr));
             node = node->left;
         }
     }
@@ -664,7 +2291,32 @@ void RedBlackTree::On_EnableRBTValidations(bool state)
     enableRBTValidations = state;
 }
 
-std::variant<qint16, QString, QChar> RedBlackTree::ConvertValue(DataType dataType, const QString& valueStr, bool& ok)
+bool RedBlackTree::IsValidKey(DataType type, qsizetype length, qint16 number)
+{
+    if (type != dataType)
+    {
+        emit ErrorMessageSignal("Invalid node data!\nKey type doesn't match the tree's data type.");
+        return false;
+    }
+
+    if (type == DataType::NUMBER && !(number > LOWER_BOUND && number < UPPER_BOUND))
+    {
+        emit ErrorMessageSignal(QString("Invalid node data!\nNumber must be between %1 and %2.")
+                                .arg(LOWER_BOUND).arg(UPPER_BOUND));
+        return false;
+    }
+
+    if (type == DataType::TEXT && length > MAX_LENGTH)
+    {
+        emit ErrorMessageSignal(QString("Invalid node data!\nText must be less than %1 characters.")
+                                    .arg(MAX_LENGTH + 1));
+        return false;
+    }
+
+    return true;
+}
+
+NodeData RedBlackTree::ConvertValue(DataType dataType, const QString& valueStr, bool& ok)
 {
     switch(dataType)
     {
@@ -702,13 +2354,36 @@ std::variant<qint16, QString, QChar> RedBlackTree::ConvertValue(DataType dataTyp
             ok = false;
             return QChar{};
         }
+    case DataType::INTERVAL:
+    {
+        QStringView view = QStringView(valueStr).trimmed();
+        qsizetype comma = view.indexOf(u',');
+        bool lowOk = false, highOk = false;
+        qint16 low = 0, high = 0;
+
+        if (view.startsWith(u'[') && view.endsWith(u']') && comma > 0)
+        {
+            low = view.mid(1, comma - 1).trimmed().toShort(&lowOk);
+            high = view.mid(comma + 1, view.length() - comma - 2).trimmed().toShort(&highOk);
+        }
+
+        if (!lowOk || !highOk || low > high || low <= LOWER_BOUND || high >= UPPER_BOUND)
+        {
+            emit ErrorMessageSignal(QString("Invalid node data!\nInterval must be written as [low,high] with low <= high, "
+                                            "both between %1 and %2.").arg(LOWER_BOUND).arg(UPPER_BOUND));
+            ok = false;
+            return Interval{};
+        }
+        ok = true;
+        return Interval{low, high};
+    }
     default:
-        return std::variant<qint16, QString, QChar>{};
+        return NodeData{};
     }
 }
 
 template<class T>
-void RedBlackTree::ReadTree(T& in, std::shared_ptr<Node>& node, DataType dataType, bool& ok)
+void RedBlackTree::ReadTree(T& in, RedBlackTree& tree, Node*& node, bool& ok)
 {
     QString valueStr;
     QChar colorChar;
@@ -720,13 +2395,10 @@ void RedBlackTree::ReadTree(T& in, std::shared_ptr<Node>& node, DataType dataTyp
         return;
     }
 
-    auto value = ConvertValue(dataType, valueStr, ok);
+    auto value = ConvertValue(tree.dataType, valueStr, ok);
 
     if (!ok)
-    {
-        root = NIL;
         return;
-    }
 
     if constexpr (std::is_same_v<T, QTextStream>)
         in.skipWhiteSpace();
@@ -740,13 +2412,32 @@ void RedBlackTree::ReadTree(T& in, std::shared_ptr<Node>& node, DataType dataTyp
         return;
     }
 
-    node = std::make_shared<Node>(value, color);
+    quint32 count = 1;
+    if (tree.isMultiset)
+    {
+        in >> count;
+        if (count == 0 || in.status())
+        {
+            emit ErrorMessageSignal("Invalid node count!");
+            ok = false;
+            return;
+        }
+    }
+
+    node = tree.pool->Create(value, color);
+    node->count = count;
+
+    if constexpr (std::is_same_v<T, QDataStream>)
+    {
+        if (tree.hasPayloads)
+            in >> node->EnsurePayload();
+    }
 
-    ReadTree(in, node->left, dataType, ok);
+    ReadTree(in, tree, node->left, ok);
     if (node->left != NIL)
         node->left->parent = node;
 
-    ReadTree(in, node->right, dataType, ok);
+    ReadTree(in, tree, node->right, ok);
     if (node->right != NIL)
         node->right->parent = node;
 }
@@ -754,7 +2445,7 @@ void RedBlackTree::ReadTree(T& in, std::shared_ptr<Node>& node, DataType dataTyp
 
 void RedBlackTree::WriteTree(QTextStream& out, const Node* node, bool isFirst) const
 {
-    if (node == NIL.get())
+    if (node == NIL)
     {
         out << " NIL";
         return;
@@ -763,23 +2454,29 @@ void RedBlackTree::WriteTree(QTextStream& out, const Node* node, bool isFirst) c
     if (!isFirst)
         out << " ";
     out << node->GetDataString() << " " << node->GetColorChar();
+    if (isMultiset)
+        out << " " << node->count;
 
-    WriteTree(out, node->left.get(), false);
-    WriteTree(out, node->right.get(), false);
+    WriteTree(out, node->left, false);
+    WriteTree(out, node->right, false);
 }
 
 void RedBlackTree::WriteTree(QDataStream &out, const Node *node) const
 {
-    if (node == NIL.get())
+    if (node == NIL)
     {
         out << QStringLiteral("NIL");
         return;
     }
 
     out << node->GetDataString() << node->GetColorChar();
+    if (isMultiset)
+        out << node->count;
+    if (hasPayloads)
+        out << node->GetPayload();
 
-    WriteTree(out, node->left.get());
-    WriteTree(out, node->right.get());
+    WriteTree(out, node->left);
+    WriteTree(out, node->right);
 }
 
 template<class T>
@@ -788,14 +2485,83 @@ void RedBlackTree::ReadFromStream(T &in, RedBlackTree &newRedBlackTree, bool &ok
     QChar type;
     in >> type;
 
+    // Multisets put an M in front of the data type and a count after every color, maps
+    // a V and the payload after every node of a binary file.
+    if (type == QChar('M'))
+    {
+        newRedBlackTree.isMultiset = true;
+        in >> type;
+    }
+
+    if (type == QChar('V'))
+    {
+        newRedBlackTree.hasPayloads = true;
+        in >> type;
+    }
+
     if (!newRedBlackTree.SetTreeDataType(type.toLatin1()))
     {
-        emit ErrorMessageSignal("Invalid tree data type!\nPossible characters: N, T, C");
+        emit ErrorMessageSignal("Invalid tree data type!\nPossible characters: N, T, C, I");
         ok = false;
         return;
     }
 
-    ReadTree(in, newRedBlackTree.root, newRedBlackTree.dataType, ok);
+    ReadTree(in, newRedBlackTree, newRedBlackTree.root, ok);
+}
+
+void RedBlackTree::ReadKeys(QFile& file, RedBlackTree& newRedBlackTree, bool& ok)
+{
+    QTextStream in(&file);
+    QString type = in.readLine().trimmed();
+
+    // Multisets put an M in front of the data type and a tab and the count after every key.
+    if (type.length() == 2 && type.at(0) == QChar('M'))
+    {
+        newRedBlackTree.isMultiset = true;
+        type.remove(0, 1);
+    }
+
+    if (type.length() != 1 || !newRedBlackTree.SetTreeDataType(type.at(0).toLatin1()))
+    {
+        emit ErrorMessageSignal("Invalid tree data type!\nPossible characters: N, T, C, I");
+        ok = false;
+        return;
+    }
+
+    std::vector<NodeData> values;
+    std::vector<quint32> counts;
+    while (!in.atEnd())
+    {
+        QString line = in.readLine().trimmed();
+        if (line.isEmpty())
+            continue;
+
+        if (newRedBlackTree.isMultiset)
+        {
+            qsizetype tab = line.lastIndexOf(QChar('\t'));
+            quint32 count = tab < 0 ? 0 : line.mid(tab + 1).toUInt(&ok);
+            if (!ok || count == 0)
+            {
+                emit ErrorMessageSignal("Every key of a multiset needs a positive count!");
+                ok = false;
+                return;
+            }
+
+            counts.push_back(count);
+            line.truncate(tab);
+        }
+
+        values.push_back(ConvertValue(newRedBlackTree.dataType, line, ok));
+        if (!ok)
+            return;
+    }
+
+    if (newRedBlackTree.isMultiset)
+        SortValues(values, counts);
+    else
+        SortValues(values);
+
+    newRedBlackTree.Assign(values, counts);
 }
 
 void RedBlackTree::ReadJSON(const QString& fileData, RedBlackTree &redBlackTree, bool &ok)
@@ -817,7 +2583,7 @@ void RedBlackTree::ReadJSON(const QString& fileData, RedBlackTree &redBlackTree,
 
     if (dataType.length() != 1 || !redBlackTree.SetTreeDataType(dataType.at(0).toLatin1()))
     {
-        emit ErrorMessageSignal("Invalid tree data type!\nPossible characters: N, T, C");
+        emit ErrorMessageSignal("Invalid tree data type!\nPossible characters: N, T, C, I");
         ok = false;
         return;
     }
@@ -829,8 +2595,14 @@ void RedBlackTree::ReadJSON(const QString& fileData, RedBlackTree &redBlackTree,
         return;
     }
 
+    redBlackTree.isMultiset = jsonObj["multiset"].toBool();
+    redBlackTree.hasPayloads = jsonObj["map"].toBool();
+
     QJsonArray tree = jsonObj["tree"].toArray();
-    QMap<int, std::shared_ptr<Node>> nodeMap;
+    std::vector<NodePool::Handle> ownedNodes;
+    ownedNodes.reserve(tree.size());
+    redBlackTree.pool->Reserve(tree.size());
+    QMap<int, Node*> nodeMap;
     std::vector<int> indexes;
     int i = 0;
 
@@ -841,8 +2613,19 @@ void RedBlackTree::ReadJSON(const QString& fileData, RedBlackTree &redBlackTree,
         if (!CheckJsonKey(nodeObj, "color", ok) || !CheckJsonKey(nodeObj, "value", ok))
             return;
 
-        auto value = ConvertValue(redBlackTree.GetDataType(),
-            nodeObj["value"].isDouble() ? QString::number(nodeObj["value"].toInt()) : nodeObj["value"].toString(), ok);
+        QJsonValue jsonValue = nodeObj["value"];
+        QString valueStr = jsonValue.toString();
+
+        if (jsonValue.isDouble())
+            valueStr = QString::number(jsonValue.toInt());
+        else if (jsonValue.isArray())
+        {
+            QJsonArray bounds = jsonValue.toArray();
+            if (bounds.size() == 2 && bounds[0].isDouble() && bounds[1].isDouble())
+                valueStr = QString("[%1,%2]").arg(bounds[0].toInt()).arg(bounds[1].toInt());
+        }
+
+        auto value = ConvertValue(redBlackTree.GetDataType(), valueStr, ok);
 
         if (!ok)
             return;
@@ -855,6 +2638,20 @@ void RedBlackTree::ReadJSON(const QString& fileData, RedBlackTree &redBlackTree,
             return;
         }
 
+        int count = 1;
+        if (nodeObj.contains("count"))
+        {
+            QJsonValue countValue = nodeObj["count"];
+            count = countValue.toInt();
+
+            if (!countValue.isDouble() || count < 1 || (!redBlackTree.isMultiset && count != 1))
+            {
+                emit ErrorMessageSignal("Invalid node count!");
+                ok = false;
+                return;
+            }
+        }
+
         QJsonValue leftValue = nodeObj["left"];
         QJsonValue rightValue = nodeObj["right"];
 
@@ -864,13 +2661,33 @@ void RedBlackTree::ReadJSON(const QString& fileData, RedBlackTree &redBlackTree,
         if (rightValue.isDouble())
             indexes.push_back(rightValue.toInt());
 
-        std::shared_ptr<Node> newNode = std::make_shared<Node>(value, color);
-        nodeMap.insert(i++, newNode);
+        ownedNodes.push_back(redBlackTree.pool->MakeHandle(value, color));
+        ownedNodes.back()->count = count;
+
+        // JSON numbers are doubles, the payload is converted back to its recorded type.
+        if (redBlackTree.hasPayloads && nodeObj.contains("payload"))
+        {
+            QVariant payload = nodeObj["payload"].toVariant();
+            QString payloadType = nodeObj["payloadType"].toString();
+            if (!payloadType.isEmpty() && !payload.convert(QMetaType::fromName(payloadType.toUtf8())))
+            {
+                emit ErrorMessageSignal("Invalid node payload!");
+                ok = false;
+                return;
+            }
+            ownedNodes.back()->EnsurePayload() = std::move(payload);
+        }
+        nodeMap.insert(i++, ownedNodes.back().get());
     }
 
-    auto it = std::adjacent_find(indexes.begin(), indexes.end(), std::greater<int>());
+    // Every node except the root has to be referenced exactly once, otherwise
+    // nodes would be shared between parents or unreachable from the root. Exports
+    // list the nodes in preorder, so the indexes don't appear in ascending order.
+    std::sort(indexes.begin(), indexes.end());
+    auto it = std::adjacent_find(indexes.begin(), indexes.end());
 
     if (it != indexes.end() ||
+       (!nodeMap.isEmpty() && indexes.size() != static_cast<size_t>(nodeMap.count() - 1)) ||
        !std::all_of(indexes.begin(), indexes.end(), [nodeMap](int x) { return x > 0 && x < nodeMap.count(); }))
     {
         emit ErrorMessageSignal("Invalid indexes!");
@@ -883,7 +2700,8 @@ void RedBlackTree::ReadJSON(const QString& fileData, RedBlackTree &redBlackTree,
     {
         QJsonObject nodeObj = nodeValue.toObject();
 
-        auto currentNode = nodeMap.value(i++);
+        int currentIndex = i++;
+        auto currentNode = nodeMap.value(currentIndex);
 
         if (!CheckJsonKey(nodeObj, "left", ok) || !CheckJsonKey(nodeObj, "right", ok))
             return;
@@ -893,7 +2711,7 @@ void RedBlackTree::ReadJSON(const QString& fileData, RedBlackTree &redBlackTree,
 
         if (!leftValue.isNull())
         {
-            if  (!leftValue.isDouble())
+            if  (!leftValue.isDouble() || leftValue.toInt() <= currentIndex)
             {
                 emit ErrorMessageSignal("Invalid left node index!");
                 ok = false;
@@ -909,7 +2727,7 @@ void RedBlackTree::ReadJSON(const QString& fileData, RedBlackTree &redBlackTree,
 
         if (!rightValue.isNull())
         {
-            if  (!rightValue.isDouble())
+            if  (!rightValue.isDouble() || rightValue.toInt() <= currentIndex)
             {
                 emit ErrorMessageSignal("Invalid right node index!");
                 ok = false;
@@ -927,6 +2745,9 @@ void RedBlackTree::ReadJSON(const QString& fileData, RedBlackTree &redBlackTree,
 
     if (!nodeMap.isEmpty())
         redBlackTree.root = nodeMap.first();
+
+    for (auto& node : ownedNodes)
+        node.release();
 }
 
 bool RedBlackTree::CheckJsonKey(const QJsonObject &obj, const QString &key, bool &ok)
@@ -946,11 +2767,15 @@ void RedBlackTree::WriteJSON(QFile& file) const
     QJsonObject jsonObj;
 
     jsonObj.insert("dataType", QString(GetTreeDataTypeChar().toLatin1()));
+    if (isMultiset)
+        jsonObj.insert("multiset", true);
+    if (hasPayloads)
+        jsonObj.insert("map", true);
 
     QJsonArray treeArray;
-    QMap<std::shared_ptr<Node>, int> nodeMap;
+    QMap<const Node*, int> nodeMap;
 
-    std::function<void(const std::shared_ptr<Node>&)> serializeNode = [this, &treeArray, &serializeNode, &nodeMap](const std::shared_ptr<Node>& node)
+    std::function<void(const Node*)> serializeNode = [this, &treeArray, &serializeNode, &nodeMap](const Node* node)
     {
         if (node == NIL)
             return;
@@ -959,10 +2784,22 @@ void RedBlackTree::WriteJSON(QFile& file) const
         QJsonObject nodeObj;
         if (dataType == DataType::NUMBER)
             nodeObj.insert("value", node->GetDataString().toInt());
+        else if (dataType == DataType::INTERVAL)
+        {
+            const Interval& interval = node->GetData<Interval>();
+            nodeObj.insert("value", QJsonArray{ interval.low, interval.high });
+        }
         else
             nodeObj.insert("value", node->GetDataString());
 
         nodeObj.insert("color", QString(node->GetColorChar()));
+        if (isMultiset)
+            nodeObj.insert("count", static_cast<qint64>(node->count));
+        if (hasPayloads && node->GetPayload().isValid())
+        {
+            nodeObj.insert("payload", QJsonValue::fromVariant(node->GetPayload()));
+            nodeObj.insert("payloadType", QString(node->GetPayload().typeName()));
+        }
 
         treeArray.append(nodeObj);
 
@@ -978,7 +2815,7 @@ void RedBlackTree::WriteJSON(QFile& file) const
 
     for (auto it = nodeMap.constBegin(); it != nodeMap.constEnd(); ++it)
     {
-        const std::shared_ptr<Node>& node = it.key();
+        const Node* node = it.key();
         int index = it.value();
 
         QJsonObject nodeObj = treeArray[index].toObject();
@@ -1007,7 +2844,8 @@ void RedBlackTree::ReadXML(QFile &file, RedBlackTree &redBlackTree, bool &ok)
     QXmlStreamReader xml(&file);
 
     QList<QString> leftInd, rightInd;
-    QMap<unsigned int, std::shared_ptr<Node>> nodeMap;
+    std::vector<NodePool::Handle> ownedNodes;
+    QMap<unsigned int, Node*> nodeMap;
     int i = 0;
 
     while (!xml.atEnd() && !xml.hasError())
@@ -1023,15 +2861,27 @@ void RedBlackTree::ReadXML(QFile &file, RedBlackTree &redBlackTree, bool &ok)
 
                 if (dataType.length() != 1 || !redBlackTree.SetTreeDataType(dataType.at(0).toLatin1()))
                 {
-                    emit ErrorMessageSignal("Invalid tree data type!\nPossible characters: N, T, C");
+                    emit ErrorMessageSignal("Invalid tree data type!\nPossible characters: N, T, C, I");
                     ok = false;
                     return;
                 }
             }
+            else if (xml.name() == QStringLiteral("multiset"))
+            {
+                xml.readNext();
+                redBlackTree.isMultiset = xml.text().toString() == QStringLiteral("true");
+            }
+            else if (xml.name() == QStringLiteral("map"))
+            {
+                xml.readNext();
+                redBlackTree.hasPayloads = xml.text().toString() == QStringLiteral("true");
+            }
             else if (xml.name() == QStringLiteral("node"))
             {
-                std::variant<qint16, QString, QChar> value;
+                NodeData value;
                 Color color;
+                quint32 count = 1;
+                QString payload, payloadType;
                 char checkAssigns = 0b0000;
 
                 while (!(xml.tokenType() == QXmlStreamReader::EndElement && xml.name() == QStringLiteral("node")))
@@ -1075,6 +2925,28 @@ void RedBlackTree::ReadXML(QFile &file, RedBlackTree &redBlackTree, bool &ok)
 
                             checkAssigns |= 0b1000;
                         }
+                        else if (xml.name() == QStringLiteral("payload"))
+                        {
+                            xml.readNext();
+                            payload = xml.text().toString();
+                        }
+                        else if (xml.name() == QStringLiteral("payloadType"))
+                        {
+                            xml.readNext();
+                            payloadType = xml.text().toString();
+                        }
+                        else if (xml.name() == QStringLiteral("count"))
+                        {
+                            xml.readNext();
+                            count = xml.text().toString().toUInt(&ok);
+
+                            if (!ok || count < 1 || (!redBlackTree.isMultiset && count != 1))
+                            {
+                                emit ErrorMessageSignal("Invalid node count!");
+                                ok = false;
+                                return;
+                            }
+                        }
                     }
 
                     if (xml.hasError())
@@ -1089,13 +2961,27 @@ void RedBlackTree::ReadXML(QFile &file, RedBlackTree &redBlackTree, bool &ok)
 
                 if (checkAssigns != 0b1111)
                 {
-                    emit ErrorMessageSignal("Invalid or missing xml node!\nAllowed nodes are: value, color, left, right.");
+                    emit ErrorMessageSignal("Invalid or missing xml node!\nAllowed nodes are: value, color, left, right, count, payload, payloadType.");
                     ok = false;
                     return;
                 }
 
-                std::shared_ptr<Node> newNode = std::make_shared<Node>(value, color);
-                nodeMap.insert(i++, newNode);
+                ownedNodes.push_back(redBlackTree.pool->MakeHandle(value, color));
+                ownedNodes.back()->count = count;
+
+                // XML only keeps text, the payload is converted back to its recorded type.
+                if (redBlackTree.hasPayloads && !payloadType.isEmpty())
+                {
+                    QVariant nodeValue(payload);
+                    if (!nodeValue.convert(QMetaType::fromName(payloadType.toUtf8())))
+                    {
+                        emit ErrorMessageSignal("Invalid node payload!");
+                        ok = false;
+                        return;
+                    }
+                    ownedNodes.back()->EnsurePayload() = std::move(nodeValue);
+                }
+                nodeMap.insert(i++, ownedNodes.back().get());
             }
         }
     }
@@ -1119,7 +3005,7 @@ void RedBlackTree::ReadXML(QFile &file, RedBlackTree &redBlackTree, bool &ok)
         {
             unsigned int leftIndex = leftValue.toUInt(&ok);
 
-            if  (!ok || leftIndex == 0 || leftIndex >= nodeMap.count())
+            if  (!ok || leftIndex <= static_cast<unsigned int>(i) || leftIndex >= nodeMap.count())
             {
                 emit ErrorMessageSignal("Invalid left node index!");
                 ok = false;
@@ -1138,7 +3024,7 @@ void RedBlackTree::ReadXML(QFile &file, RedBlackTree &redBlackTree, bool &ok)
         {
             unsigned int rightIndex = rightValue.toUInt(&ok);
 
-            if  (!ok || rightIndex == 0 || rightIndex >= nodeMap.count())
+            if  (!ok || rightIndex <= static_cast<unsigned int>(i) || rightIndex >= nodeMap.count())
             {
                 emit ErrorMessageSignal("Invalid right node index!");
                 ok = false;
@@ -1154,9 +3040,11 @@ void RedBlackTree::ReadXML(QFile &file, RedBlackTree &redBlackTree, bool &ok)
             currentNode->right = NIL;
     }
 
-    auto it = std::adjacent_find(indexes.begin(), indexes.end(), std::greater<int>());
+    std::sort(indexes.begin(), indexes.end());
+    auto it = std::adjacent_find(indexes.begin(), indexes.end());
 
-    if (it != indexes.end())
+    if (it != indexes.end() ||
+       (!nodeMap.isEmpty() && indexes.size() != static_cast<size_t>(nodeMap.count() - 1)))
     {
         emit ErrorMessageSignal("Invalid indexes!");
         ok = false;
@@ -1165,6 +3053,9 @@ void RedBlackTree::ReadXML(QFile &file, RedBlackTree &redBlackTree, bool &ok)
 
     if (!nodeMap.isEmpty())
         redBlackTree.root = nodeMap.first();
+
+    for (auto& node : ownedNodes)
+        node.release();
 }
 
 void RedBlackTree::WriteXML(QFile &file) const
@@ -1175,12 +3066,16 @@ void RedBlackTree::WriteXML(QFile &file) const
 
     stream.writeStartElement("treeData");
     stream.writeTextElement("dataType", GetTreeDataTypeChar());
+    if (isMultiset)
+        stream.writeTextElement("multiset", "true");
+    if (hasPayloads)
+        stream.writeTextElement("map", "true");
     stream.writeStartElement("nodes");
 
-    QMap<std::shared_ptr<Node>, int> nodeMap;
-    QList<std::shared_ptr<Node>> nodeList;
+    QMap<Node*, int> nodeMap;
+    QList<Node*> nodeList;
 
-    QQueue<std::shared_ptr<Node>> queue;
+    QQueue<Node*> queue;
 
     if (root)
         queue.enqueue(root);
@@ -1206,6 +3101,14 @@ void RedBlackTree::WriteXML(QFile &file) const
 
         stream.writeTextElement("value", node->GetDataString());
         stream.writeTextElement("color", node->GetColorChar());
+        if (isMultiset)
+            stream.writeTextElement("count", QString::number(node->count));
+        const QVariant& payload = std::as_const(*node).GetPayload();
+        if (hasPayloads && payload.isValid())
+        {
+            stream.writeTextElement("payload", payload.toString());
+            stream.writeTextElement("payloadType", payload.typeName());
+        }
 
         stream.writeTextElement("left", (node->left != NIL ? QString::number(nodeMap[node->left]) : ""));
         stream.writeTextElement("right", (node->right != NIL ? QString::number(nodeMap[node->right]) : ""));
@@ -1259,10 +3162,15 @@ bool RedBlackTree::ImportTree(const QString& fileName)
     {
         ReadXML(file, newRedBlackTree, ok);
     }
+    else if (suffix == QStringLiteral("keys"))
+    {
+        ReadKeys(file, newRedBlackTree, ok);
+    }
 
     QString errMsg = "";
 
-    if (enableRBTValidations)
+    // Key lists are built balanced and colored by depth, they are valid by construction.
+    if (enableRBTValidations && suffix != QStringLiteral("keys"))
     {
         if (newRedBlackTree.root->color != Color::BLACK)
             errMsg += "The root of the tree must be black!";
@@ -1281,7 +3189,16 @@ bool RedBlackTree::ImportTree(const QString& fileName)
 
     if (ok && errMsg.isEmpty())
     {
-        newRedBlackTree.root->parent = NIL;
+        // The file brings keys, colors and payloads, the modes and the index of this
+        // tree stay. A map keeps its payloads even when the file has none.
+        if (newRedBlackTree.root != NIL)
+            newRedBlackTree.root->parent = NIL;
+        newRedBlackTree.hasPayloads = newRedBlackTree.hasPayloads || hasPayloads;
+        newRedBlackTree.aggregate = aggregate;
+        newRedBlackTree.isLazyDelete = isLazyDelete;
+        newRedBlackTree.compactionThreshold = compactionThreshold;
+        newRedBlackTree.isRelaxedBalance = isRelaxedBalance;
+        newRedBlackTree.hashIndex = std::move(hashIndex);
         *this = std::move(newRedBlackTree);
         UpdateHeight();
         UpdateNodeCount();
@@ -1302,6 +3219,8 @@ bool RedBlackTree::ExportTree(const QString& fileName)
     if (root == NIL || fileName.isEmpty())
         return false;
 
+    Settle();
+
     QFile file(fileName);
 
     QFileInfo fileInfo(fileName);
@@ -1318,17 +3237,23 @@ bool RedBlackTree::ExportTree(const QString& fileName)
     {
         QTextStream out(&file);
 
+        if (isMultiset)
+            out << QChar('M');
         out << GetTreeDataTypeChar() << "\n";
 
-        WriteTree(out, root.get());
+        WriteTree(out, root);
     }
     else if (isBinary)
     {
         QDataStream out(&file);
 
+        if (isMultiset)
+            out << QChar('M');
+        if (hasPayloads)
+            out << QChar('V');
         out << GetTreeDataTypeChar();
 
-        WriteTree(out, root.get());
+        WriteTree(out, root);
     }
     else if (suffix == QStringLiteral("json"))
     {
@@ -1338,6 +3263,22 @@ bool RedBlackTree::ExportTree(const QString& fileName)
     {
         WriteXML(file);
     }
+    else if (suffix == QStringLiteral("keys"))
+    {
+        QTextStream out(&file);
+
+        if (isMultiset)
+            out << QChar('M');
+        out << GetTreeDataTypeChar() << "\n";
+
+        for (const Node& node : *this)
+        {
+            out << node.GetDataString();
+            if (isMultiset)
+                out << QChar('\t') << node.count;
+            out << "\n";
+        }
+    }
 
     return true;
 }
@@ -1345,15 +3286,15 @@ bool RedBlackTree::ExportTree(const QString& fileName)
 
 // void RedBlackTree::PrintTree(const Node* node, QListWidget* list, int depth)
 // {
-//     if (node == NIL.get())
+//     if (node == NIL)
 //     {
 //         list->addItem(QString(depth * 2, ' ') + "NIL");
 //         return;
 //     }
 
 //     list->addItem(QString(depth * 2, ' ') + node->GetDataString() + " (" + node->GetColorChar() + ")\n");
-//     PrintTree(node->left.get(), list, depth + 1);
-//     PrintTree(node->right.get(), list, depth + 1);
+//     PrintTree(node->left, list, depth + 1);
+//     PrintTree(node->right, list, depth + 1);
 // }
 
 
@@ -1361,10 +3302,26 @@ RedBlackTree& RedBlackTree::operator=(RedBlackTree&& other) noexcept
 {
     if (this != &other)
     {
-        root = std::move(other.root);
+        ReleaseNodes();
+        std::swap(pool, other.pool);
+        root = std::exchange(other.root, NIL);
+        hashIndex = std::move(other.hashIndex);
+        indexLookups = std::exchange(other.indexLookups, 0);
+        indexHits = std::exchange(other.indexHits, 0);
+        ResetCaches();
+        other.ResetCaches();
         dataType = other.dataType;
+        isMultiset = other.isMultiset;
+        hasPayloads = other.hasPayloads;
+        aggregate = other.aggregate;
+        isLazyDelete = other.isLazyDelete;
+        compactionThreshold = other.compactionThreshold;
+        isRelaxedBalance = other.isRelaxedBalance;
         height = other.height;
-        nodeCount = other.nodeCount;
+        isHeightStale = other.isHeightStale;
+        nodeCount = std::exchange(other.nodeCount, 0);
+        tombstoneCount = std::exchange(other.tombstoneCount, 0);
+        pendingFixups = std::exchange(other.pendingFixups, {});
     }
     return *this;
 }
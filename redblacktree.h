@@ -4,29 +4,120 @@
 #include <QTextStream>
 #include <QFileInfo>
 #include <QColor>
+#include <QHash>
+#include <iterator>
+#include <optional>
 #include "node.h"
-
-enum class DataType { NUMBER, TEXT, CHAR };
+#include "nodepool.h"
+#include "tracebuffer.h"
+#include "redblackengine.h"
+
+enum class DataType { NUMBER, TEXT, CHAR, INTERVAL };
+
+// Visualization signals are emitted through RBT_EMIT, which also records them in the
+// sender's trace buffer while tracing is enabled. A headless build (RBT_HEADLESS)
+// compiles the signals out and only keeps the trace. The inline code below uses it as
+// well, so the library and its users have to agree on RBT_HEADLESS. ErrorMessageSignal
+// is emitted in both builds.
+#ifdef RBT_HEADLESS
+#define RBT_EMIT_FROM(sender, ...) \
+    do { if ((sender)->trace) (sender)->trace->__VA_ARGS__; } while (false)
+#else
+#define RBT_EMIT_FROM(sender, ...) \
+    do { if ((sender)->trace) (sender)->trace->__VA_ARGS__; emit (sender)->__VA_ARGS__; } while (false)
+#endif
+#define RBT_EMIT(...) RBT_EMIT_FROM(this, __VA_ARGS__)
 
 class RedBlackTree : public QObject
 {
     Q_OBJECT
 private:
-    std::shared_ptr<Node> root;
-    quint16 height, nodeCount;
+    Node* root;
+    std::shared_ptr<NodePool> pool;
+    std::unique_ptr<TraceBuffer> trace;
+    quint64 nodeCount;
+
+    // Cached smallest and largest node, NIL while the tree is empty. Single inserts and
+    // deletes update them in O(1), bulk operations that replace the root reset them.
+    Node* leftmost;
+    Node* rightmost;
+
+    // Optional exact-match index from key to one node holding it, null while disabled.
+    std::unique_ptr<QHash<NodeData, Node*>> hashIndex;
+    quint64 indexLookups;
+    quint64 indexHits;
+
+    // Lazy deletion, see SetLazyDelete. Tombstones stay linked until the next Compact.
+    bool isLazyDelete;
+    double compactionThreshold;
+    quint64 tombstoneCount;
+
+    // Relaxed balance, see SetRelaxedBalance. Nodes linked without InsertFixup wait here.
+    bool isRelaxedBalance;
+    std::vector<Node*> pendingFixups;
+
+    // The exact height is only needed for drawing, so it is recomputed lazily after a
+    // modification instead of on every Insert/Delete.
+    mutable quint32 height;
+    mutable bool isHeightStale;
 
     DataType dataType;
+    bool isMultiset;
+    Aggregate aggregate;
 
     bool enableRBTValidations;
 public:
+    // In-order iterator over the nodes. Increments follow the parent links, so they
+    // are O(1) amortized, allocate nothing and emit no signals. Tombstones are stepped
+    // over. End is NIL, decrementing it yields the largest node.
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = Node;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Node*;
+        using reference = const Node&;
+
+        const_iterator() = default;
+
+        reference operator*() const { return *node; }
+        pointer operator->() const { return node; }
+
+        const_iterator& operator++();
+        const_iterator& operator--();
+        const_iterator operator++(int) { auto it = *this; ++*this; return it; }
+        const_iterator operator--(int) { auto it = *this; --*this; return it; }
+
+        bool operator==(const const_iterator& other) const { return node == other.node; }
+        bool operator!=(const const_iterator& other) const { return node != other.node; }
+
+    private:
+        friend class RedBlackTree;
+        const_iterator(const Node* node, const RedBlackTree* tree) : node(node), tree(tree) {}
+
+        const Node* node = NIL;
+        const RedBlackTree* tree = nullptr;
+    };
+    using iterator = const_iterator;
+
     RedBlackTree();
+    ~RedBlackTree();
 
-    std::shared_ptr<Node> GetRoot() const { return root; }
-    quint16 GetHeight() const { return height; }
-    quint16 GetNodeCount() const { return nodeCount; }
+    Node* GetRoot() const { return root; }
+    quint32 GetHeight() const;
+    quint32 GetHeightBound() const;
+    quint64 GetNodeCount() const { return nodeCount; }
     DataType GetDataType() const { return dataType; }
+    NodePool::Statistics GetPoolStatistics() const { return pool->GetStatistics(); }
+
+    // Records every visualization step into a ring buffer of fixed-size events until
+    // DisableTrace, GetTrace is null while tracing is off.
+    void EnableTrace(std::size_t capacity = TraceBuffer::DEFAULT_CAPACITY);
+    void DisableTrace() { trace.reset(); }
+    TraceBuffer* GetTrace() const { return trace.get(); }
 
-    quint16 GetNewNodeHeight(const QString &key);
+    quint32 GetNewNodeHeight(const QString &key);
 
     bool ImportTree(const QString& fileName);
     bool ExportTree(const QString& fileName);
@@ -37,17 +128,207 @@ public:
 
     RedBlackTree& operator=(RedBlackTree&& other) noexcept;
 
-    void Insert(const QString &key);
+    // Where an insertion put its key: the node holding it and the depth it was linked
+    // at before rebalancing, 1 for the root, which is what GetNewNodeHeight predicts.
+    // The node is NIL for a rejected key, the depth 0 when a multiset only counted a
+    // copy.
+    struct InsertResult
+    {
+        const Node* node = NIL;
+        quint32 depth = 0;
+    };
+
+    InsertResult Insert(const QString &key);
+
+    // Starts the search at hint, a node of this tree such as the result of the previous
+    // insertion, instead of at the root. It climbs the parent links until the key falls
+    // inside the subtree and descends from there, so sequential or clustered keys take
+    // O(log d) comparisons for a key d positions away from hint. A NIL hint starts at
+    // the root.
+    InsertResult InsertHinted(const Node* hint, const QString& key);
     bool Delete(const QString& key);
     bool Find(const QString& key);
+
+    // Typed overloads skip the parsing of the QString versions, Find and Delete compare
+    // the given key in place and don't allocate. The key type has to match the data type
+    // of the tree, the highlight signals get no key text.
+    InsertResult Insert(qint16 key);
+    InsertResult Insert(QChar key);
+    InsertResult Insert(QStringView key);
+    InsertResult Insert(QLatin1StringView key);
+    bool Delete(qint16 key);
+    bool Delete(QChar key);
+    bool Delete(QStringView key);
+    bool Delete(QLatin1StringView key);
+    bool Find(qint16 key);
+    bool Find(QChar key);
+    bool Find(QStringView key);
+    bool Find(QLatin1StringView key);
+
+    // Opt-in hash index from key to node. While it is enabled Find answers from it in
+    // O(1) instead of descending the tree, except for the view overloads which would
+    // need a QString to hash. Single inserts and deletes keep it in sync, operations that
+    // replace the root such as Join, Split or a rebuild refill it in O(n). The statistics
+    // report its size and how many lookups found their key.
+    struct HashIndexStatistics
+    {
+        std::size_t entries = 0;
+        std::size_t buckets = 0;
+        std::size_t approximateBytes = 0;
+        quint64 lookups = 0;
+        quint64 hits = 0;
+    };
+
+    void SetHashIndex(bool enabled);
+    bool HasHashIndex() const { return hashIndex != nullptr; }
+    HashIndexStatistics GetHashIndexStatistics() const;
+
+    // Min and Max read the cached extremes in O(1), stepping over tombstones, and return
+    // NIL on an empty tree. ExtractMin and ExtractMax remove them without a search and
+    // return the key, in multiset mode they remove one copy.
+    const Node* Min() const { return begin().node; }
+    const Node* Max() const { return (--end()).node; }
+    std::optional<NodeData> ExtractMin();
+    std::optional<NodeData> ExtractMax();
+
+    // In multiset mode a node holds every copy of its key: Insert of an existing key and
+    // Delete only change the node's count, and Count reads it in O(log n). GetNodeCount,
+    // the order statistics and the range operations then work on distinct keys. The
+    // mode can only be changed while the tree is empty.
+    bool SetMultiset(bool enabled);
+    bool IsMultiset() const { return isMultiset; }
+    quint64 Count(const QString& key);
+
+    // Order statistics over the subtree sizes, all of them run in O(log n).
+    // Select is 0-based and returns NIL when k is out of range, Rank counts the keys
+    // smaller than key and CountRange the keys in the closed range [lo, hi].
+    const Node* Select(quint64 k) const;
+    quint64 Rank(const QString& key);
+    quint64 CountRange(const QString& lo, const QString& hi);
+
+    // Visits the keys in [lo, hi] in order in O(log n + k).
+    void ForEachInRange(const QString& lo, const QString& hi, const std::function<void(const Node&)>& callback);
+
+    // Removes every key in [lo, hi] and returns how many there were. Small ranges are
+    // unlinked node by node without visualization, large ones rebuild the tree from the
+    // remaining nodes in O(n).
+    quint64 DeleteRange(const QString& lo, const QString& hi);
+
+    // Replaces the contents with the given keys in O(n). The keys have to be in ascending
+    // order, the tree is built balanced with only its incomplete deepest level red.
+    bool BuildFromSorted(const QStringList& keys);
+
+    // Batch updates convert every key once and sort the batch, radix sort for numbers.
+    // Batches that are small next to the tree go through quiet single updates, larger
+    // ones are merged with the tree and rebuilt in one pass. Height, count and their
+    // signals update once per batch. A batch with an invalid key is rejected as a whole.
+    bool InsertBatch(const QStringList& keys);
+    quint64 DeleteBatch(const QStringList& keys);
+
+    // Black height aware Join and Split in O(log n), nodes move between the trees without
+    // being copied. Join replaces the contents with left, pivot and right, where no key of
+    // left may be greater and no key of right smaller than the pivot, the pivot-less
+    // overload concatenates the two trees. Multisets may share a boundary key, its
+    // copies end up in a single node. Split moves the keys smaller than key to left,
+    // the others to right, and empties this tree. Both halves keep the modes and settings
+    // of this tree and get a node pool of their own, so they can be modified from
+    // different threads. Node aggregates stay valid when all trees use the same Aggregate.
+    bool Join(RedBlackTree& left, const QString& pivot, RedBlackTree& right);
+    bool Join(RedBlackTree& left, RedBlackTree& right);
+    bool Split(const QString& key, RedBlackTree& left, RedBlackTree& right);
+
+    // Join based set operations, O(m log(n/m + 1)) for trees of m <= n keys. The result
+    // replaces this tree and other is emptied. Independent subtrees are processed on the
+    // global QThreadPool, so a custom Aggregate must be safe to call concurrently. Meant
+    // for trees without duplicates, a key of both trees appears once in the result.
+    bool Union(RedBlackTree& other);
+    bool Intersection(RedBlackTree& other);
+    bool Difference(RedBlackTree& other);
+
+    // Lazy deletion makes Delete and the extracts mark the node as a tombstone in
+    // O(log n): it stays linked with a count of 0 and only the sizes and aggregates on
+    // its path are recounted, nothing is rotated. Lookups, iterators, the order
+    // statistics and the interval queries skip tombstones. Once they make up more than
+    // compactionThreshold of the linked nodes, Compact rebuilds the tree from the live
+    // ones in O(n). Batches, DeleteRange, Join, Split, the set operations and the exports
+    // compact first, and so does turning the mode off.
+    void SetLazyDelete(bool enabled, double compactionThreshold = 0.25);
+    bool IsLazyDelete() const { return isLazyDelete; }
+    quint64 GetTombstoneCount() const { return tombstoneCount; }
+    void Compact();
+
+    // Relaxed balance lets the inserts skip InsertFixup: new nodes are linked red and
+    // queued, so red nodes may follow each other and the tree may grow past the usual
+    // height bound while lookups stay correct. Rebalance repairs the queued violations
+    // one recoloring or rotation at a time, or rebuilds the tree in O(n) when the queue
+    // is large next to it. Deletes and the operations that relink whole trees rebalance
+    // first, and so does turning the mode off.
+    void SetRelaxedBalance(bool enabled);
+    bool IsRelaxedBalance() const { return isRelaxedBalance; }
+    void Rebalance();
+
+    // How far the tree is from a valid red-black tree, all zero or true once it is.
+    struct BalanceReport
+    {
+        quint64 redViolations = 0;      // red nodes with a red parent
+        quint32 longestRedRun = 0;      // most red nodes in a row on one path
+        bool isRootBlack = true;
+        bool isBlackBalanced = true;    // every path has the same number of black nodes
+        quint32 height = 0;
+        quint32 heightBound = 0;        // bound of a valid tree with as many nodes
+        quint64 pendingFixups = 0;
+
+        bool IsValid() const { return redViolations == 0 && isRootBlack && isBlackBalanced; }
+    };
+
+    BalanceReport CheckBalance() const;
+
+    const_iterator begin() const;
+    const_iterator end() const { return const_iterator(NIL, this); }
+
+    // Typed searches for hot paths, Key has to match the tree's data type.
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    const_iterator lower_bound(const Key& key) const;
+
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    const_iterator upper_bound(const Key& key) const;
+
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    std::pair<const_iterator, const_iterator> equal_range(const Key& key) const
+    {
+        return { lower_bound<Key, Compare>(key), upper_bound<Key, Compare>(key) };
+    }
+
+    // Keeps aggregate up to date in every node, RangeAggregate then combines the keys
+    // in [lo, hi] in O(log n). Returns 0 while no aggregate is set.
+    void SetAggregate(const Aggregate& aggregate);
+    const Aggregate& GetAggregate() const { return aggregate; }
+    qint64 RangeAggregate(const QString& lo, const QString& hi);
+
+    // Interval tree queries, every node keeps the largest high endpoint of its subtree.
+    // FindOverlap returns any interval overlapping the given one or NIL in O(log n), the
+    // other two return every match in key order.
+    const Node* FindOverlap(const QString& interval);
+    QList<const Node*> FindAllOverlaps(const QString& interval);
+    QList<const Node*> Stab(const QString& point);
+protected:
+    // Set by RedBlackMap, the binary, JSON and XML exports then carry the node payloads.
+    bool hasPayloads;
+
+    NodeData ConvertValue(DataType dataType, const QString& valueStr, bool& ok);
+
+    // Finds key or links a new node for it in a single descent, the flag tells whether
+    // the node was created.
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    std::pair<Node*, bool> FindOrInsert(const Key& key);
+
 private:
-    std::variant<qint16, QString, QChar> ConvertValue(DataType dataType, const QString& valueStr, bool& ok);
     bool SetTreeDataType(char type);
     QChar GetTreeDataTypeChar() const;
     bool TryGetColorFromChar(const QChar& colorChar, Color& color);
 
     template<class T>
-    void ReadTree(T& in, std::shared_ptr<Node>& node, DataType dataType, bool& ok);
+    void ReadTree(T& in, RedBlackTree& tree, Node*& node, bool& ok);
 
     template<class T>
     void ReadFromStream(T& in, RedBlackTree& newRedBlackTree, bool& ok);
@@ -55,6 +336,8 @@ private:
     void WriteTree(QTextStream& out, const Node* node, bool isFirst = true) const;
     void WriteTree(QDataStream& out, const Node* node) const;
 
+    void ReadKeys(QFile& file, RedBlackTree& newRedBlackTree, bool& ok);
+
     void ReadJSON(const QString& fileData, RedBlackTree& redBlackTree, bool& ok);
     void WriteJSON(QFile& file) const;
 
@@ -63,27 +346,178 @@ private:
     void ReadXML(QFile &file, RedBlackTree& redBlackTree, bool& ok);
     void WriteXML(QFile& file) const;
 
-    quint16 CalculateHeight(std::shared_ptr<Node> node);
-    quint16 CalculateNodeCount(std::shared_ptr<Node> node);
+    quint32 CalculateHeight(const Node* node) const;
+    void PullUpSubtree(Node* node);
 
     void UpdateHeight();
     void UpdateNodeCount();
 
-    bool IsBST(std::shared_ptr<Node> node) const;
-    bool IsValidBST(std::shared_ptr<Node> node, std::shared_ptr<Node>& prev) const;
+    bool IsBST(const Node* node) const;
+
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    bool IsValidBST(const Node* node, const Node*& prev) const;
+
+    bool IsBlackBalanced(const Node* root) const;
+
+    bool ColorValidation(const Node* node) const;
+    qint32 CheckBalance(const Node* node, quint32 depth, quint32 redRun, BalanceReport& report) const;
+
+    // Compacts and rebalances, so the operations relinking whole trees get a plain
+    // red-black tree.
+    void Settle();
+
+    // Typed descents, the key variant is resolved once per operation so every
+    // comparison on the way down is an inlined call of Compare.
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    quint32 GetNewNodeHeight(const Key& key) const;
+
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    InsertResult Insert(const Key& key, const QString& keyStr);
+
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    InsertResult InsertHinted(Node* hint, const Key& key, const QString& keyStr);
+
+    // Links the new node z below y, rebalances and returns the depth z was linked at.
+    quint32 LinkNode(Node* z, Node* y, bool isLeft);
+
+    // Lookup is any type Compare and operator== accept next to Key, QStringView for
+    // QString keys.
+    template<typename Key, typename Compare = KeyCompare<Key>, typename Lookup = Key>
+    bool Delete(const Lookup& key, const QString& keyStr);
+
+    template<typename Key, typename Compare = KeyCompare<Key>, typename Lookup = Key>
+    bool Find(const Lookup& key, const QString& keyStr);
+
+    // Checks a typed key against the data type and the limits of ConvertValue.
+    bool IsValidKey(DataType type, qsizetype length = 1, qint16 number = 0);
+
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    quint64 CountBelow(const Key& key, bool inclusive) const;
+
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    qint64 RangeAggregate(const Key& lo, const Key& hi) const;
+
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    qint64 AggregateFrom(const Node* node, const Key& lo) const;
+
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    qint64 AggregateUpTo(const Node* node, const Key& hi) const;
+
+    bool ConvertInterval(const QString& intervalStr, Interval& interval);
+    void CollectOverlaps(const Node* node, const Interval& interval, QList<const Node*>& result) const;
+
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    quint64 DeleteRange(const Key& lo, const Key& hi);
+
+    void Assign(const std::vector<NodeData>& values, const std::vector<quint32>& counts = {});
+    bool ConvertValues(const QStringList& keys, std::vector<NodeData>& values);
+    static bool IsSorted(const std::vector<NodeData>& values);
+    static bool SameKey(const NodeData& a, const NodeData& b);
+    static void SortValues(std::vector<NodeData>& values);
+    static void SortValues(std::vector<NodeData>& values, std::vector<quint32>& counts);
+    static void RadixSort(std::vector<NodeData>& values);
+
+    bool PreferRebuild(quint64 batchSize) const;
+
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    void InsertBatch(const std::vector<NodeData>& values);
+
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    quint64 DeleteBatch(const std::vector<NodeData>& values);
+
+    // A detached subtree with a black (or NIL) root and its black height.
+    struct Piece
+    {
+        Node* node;
+        quint32 blackHeight;
+    };
+
+    static quint32 BlackHeight(const Node* node);
+    static Piece Detach(Node* node, quint32 blackHeight);
+
+    bool CanJoin(const RedBlackTree& left, const RedBlackTree& right);
+    void JoinTrees(RedBlackTree& left, Node* pivot, RedBlackTree& right);
+
+    Piece JoinNodes(Piece left, Node* pivot, Piece right);
+    Node* JoinRight(Node* left, quint32 leftHeight, Node* pivot, Node* right, quint32 rightHeight);
+    Node* JoinLeft(Node* right, quint32 rightHeight, Node* pivot, Node* left, quint32 leftHeight);
+
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    std::pair<Piece, Piece> SplitNodes(Node* node, quint32 blackHeight, const Key& key);
+
+    Piece JoinPieces(Piece left, Piece right);
+    Piece SplitLast(Piece tree, Node*& last);
+
+    enum class SetOperation { UNION, INTERSECTION, DIFFERENCE };
+
+    // Subproblems smaller than this are not worth a task of their own.
+    static constexpr quint64 PARALLEL_GRAIN = 4096;
+
+    bool ApplySetOperation(RedBlackTree& other, SetOperation operation);
+
+    // Removed nodes are only collected, the pool is not thread safe and frees them afterwards.
+    template<typename Key, typename Compare = KeyCompare<Key>>
+    Piece SetOperationNodes(Piece first, Piece second, SetOperation operation, std::vector<Node*>& removed);
+
+    static void ParallelInvoke(const std::function<void()>& first, const std::function<void()>& second, bool parallel);
+
+    // Rotations inside a detached subtree, the caller links the returned subtree root.
+    Node* RotateLeftLocal(Node* x);
+    Node* RotateRightLocal(Node* x);
 
-    bool IsBlackBalanced(std::shared_ptr<Node> root) const;
+    Node* BuildBalanced(const std::vector<Node*>& nodes);
+    Node* BuildBalanced(const std::vector<Node*>& nodes, quint64 begin, quint64 end,
+                        quint32 depth, quint32 redDepth, Node* parent);
 
-    bool ColorValidation(std::shared_ptr<Node> node) const;
+    void DestroyTree(Node* node);
+    void ReleaseNodes();
 
-    void LeftRotate(std::shared_ptr<Node> x);
-    void RightRotate(std::shared_ptr<Node> x);
+    // Keep the cached extremes and the hash index in sync. ResetCaches recomputes them
+    // after the root was replaced, the others follow single links and unlinks.
+    void ResetCaches();
+    void CacheLinked(Node* z);
+    void CacheUnlinked(Node* z);
+    void Unindex(Node* z);
+    bool FindIndexed(const NodeData& key);
+    std::optional<NodeData> Extract(Node* z);
 
-    void InsertFixup(std::shared_ptr<Node> z);
+    // Lazy deletion: Bury turns a live node into a tombstone, Revive brings one back.
+    void Bury(Node* z);
+    void Revive(Node* z);
+    qint64 MapNode(const Node& node) const;
 
-    void Transplant(std::shared_ptr<Node> u, std::shared_ptr<Node> v);
-    void DeleteFixup(std::shared_ptr<Node> x);
-    std::shared_ptr<Node> Minimum(std::shared_ptr<Node> node);
+    // First live node not less than key, or NIL.
+    template<typename Key, typename Compare = KeyCompare<Key>, typename Lookup = Key>
+    const Node* LowerBound(const Lookup& key) const;
+
+    // Rotations and fixups come from the Qt-free engine, the hooks below turn its steps
+    // into visualization signals and PullUp keeps the augmentations up to date.
+    using Engine = RedBlackEngine<RedBlackTree, Node>;
+    friend Engine;
+
+    static bool IsNil(const Node* node) { return node == NIL; }
+    void PullUp(Node* node);
+    Node* Minimum(Node* node);
+
+    void OnRecolor(Node* node, Color color);
+    void OnRotate(Node* x, Node* y, bool isLeft);
+    void OnRaise(Node* y, Node* to, bool leftChild, bool isLeft, bool isRoot);
+    void OnLower(Node* x, Node* y, bool isLeft);
+    void OnRotated(Node* x, bool isLeft);
+    void OnSetParent(Node* node, Node* parent);
+    void OnSetChild(Node* node, Node* child, bool leftChild);
+    void OnTransplant(Node* v, Node* to, bool leftChild, bool isRoot);
+    void OnUnlink(Node* z);
+
+    void DeleteNode(Node* z);
+    void UnlinkNode(Node* z);
+
+    static const Node* Leftmost(const Node* node);
+    static const Node* Rightmost(const Node* node);
+
+    // In-order neighbours by the links alone, tombstones included.
+    static const Node* Successor(const Node* node);
+    static const Node* Predecessor(const Node* node);
 
 signals:
     void UpdateHeightSignal();
@@ -91,28 +525,239 @@ signals:
 
     void ErrorMessageSignal(QString);
 
-    void HighlightNodeSignal(std::shared_ptr<Node> x, QColor color, bool isLeft = true, const QString& key = "");
-    void ChangeColorSignal(std::shared_ptr<Node> node, Color color);
-    void CreateNodeSignal(std::shared_ptr<Node> node);
-    void MoveNodeSignal(std::shared_ptr<Node> node, std::shared_ptr<Node> to, bool leftChild, bool isRoot = false);
+    void HighlightNodeSignal(Node* x, QColor color, bool isLeft = true, const QString& key = "");
+    void ChangeColorSignal(Node* node, Color color);
+    void CreateNodeSignal(Node* node);
+    void MoveNodeSignal(Node* node, Node* to, bool leftChild, bool isRoot = false);
 
 
-    void MoveYSignal(std::shared_ptr<Node> node, std::shared_ptr<Node> to, bool leftChild, bool isLeftRotate, bool isRoot = false);
-    void MoveXSignal(std::shared_ptr<Node> node, std::shared_ptr<Node> to, bool leftChild);
-    void MoveStartSignal(std::shared_ptr<Node> x, std::shared_ptr<Node> y, bool x_leftChild, bool y_leftChild);
-    void ChangeParentSignal(std::shared_ptr<Node> x, std::shared_ptr<Node> y);
+    void MoveYSignal(Node* node, Node* to, bool leftChild, bool isLeftRotate, bool isRoot = false);
+    void MoveXSignal(Node* node, Node* to, bool leftChild);
+    void MoveStartSignal(Node* x, Node* y, bool x_leftChild, bool y_leftChild);
+    void ChangeParentSignal(Node* x, Node* y);
 
-    void LeftRotateSignal(std::shared_ptr<Node> x);
-    void RightRotateSignal(std::shared_ptr<Node> x);
+    void LeftRotateSignal(Node* x);
+    void RightRotateSignal(Node* x);
 
 
-    void TransplantSignal(std::shared_ptr<Node> node, std::shared_ptr<Node> to, bool leftChild, bool isRoot = false);
-    void ChangeSiblingSignal(std::shared_ptr<Node> node, std::shared_ptr<Node> to, bool leftChild);
-    void DeleteSignal(std::shared_ptr<Node> node);
+    void TransplantSignal(Node* node, Node* to, bool leftChild, bool isRoot = false);
+    void ChangeSiblingSignal(Node* node, Node* to, bool leftChild);
+    void DeleteSignal(Node* node);
 
 private slots:
     void On_EnableRBTValidations(bool state);
 };
 
 
+inline RedBlackTree::const_iterator& RedBlackTree::const_iterator::operator++()
+{
+    do
+        node = Successor(node);
+    while (node != NIL && node->IsTombstone());
+    return *this;
+}
+
+inline RedBlackTree::const_iterator& RedBlackTree::const_iterator::operator--()
+{
+    node = node == NIL ? tree->rightmost : Predecessor(node);
+    while (node != NIL && node->IsTombstone())
+        node = Predecessor(node);
+    return *this;
+}
+
+inline const Node* RedBlackTree::Successor(const Node* node)
+{
+    if (node->right != NIL)
+        return Leftmost(node->right);
+
+    const Node* parent = node->parent;
+    while (parent != NIL && node == parent->right)
+    {
+        node = parent;
+        parent = parent->parent;
+    }
+    return parent;
+}
+
+inline const Node* RedBlackTree::Predecessor(const Node* node)
+{
+    if (node->left != NIL)
+        return Rightmost(node->left);
+
+    const Node* parent = node->parent;
+    while (parent != NIL && node == parent->left)
+    {
+        node = parent;
+        parent = parent->parent;
+    }
+    return parent;
+}
+
+inline const Node* RedBlackTree::Leftmost(const Node* node)
+{
+    if (node != NIL)
+    {
+        while (node->left != NIL)
+            node = node->left;
+    }
+    return node;
+}
+
+inline const Node* RedBlackTree::Rightmost(const Node* node)
+{
+    if (node != NIL)
+    {
+        while (node->right != NIL)
+            node = node->right;
+    }
+    return node;
+}
+
+inline RedBlackTree::const_iterator RedBlackTree::begin() const
+{
+    const_iterator it(leftmost, this);
+    if (leftmost != NIL && leftmost->IsTombstone())
+        ++it;
+    return it;
+}
+
+template<typename Key, typename Compare, typename Lookup>
+const Node* RedBlackTree::LowerBound(const Lookup& key) const
+{
+    Compare compare;
+    const Node* x = root;
+    const Node* result = NIL;
+
+    while (x != NIL)
+    {
+        if (compare(x->GetData<Key>(), key))
+            x = x->right;
+        else
+        {
+            result = x;
+            x = x->left;
+        }
+    }
+
+    while (result != NIL && result->IsTombstone())
+        result = Successor(result);
+    return result;
+}
+
+template<typename Key, typename Compare>
+RedBlackTree::const_iterator RedBlackTree::lower_bound(const Key& key) const
+{
+    return const_iterator(LowerBound<Key, Compare>(key), this);
+}
+
+template<typename Key, typename Compare>
+RedBlackTree::const_iterator RedBlackTree::upper_bound(const Key& key) const
+{
+    Compare compare;
+    const Node* x = root;
+    const Node* result = NIL;
+
+    while (x != NIL)
+    {
+        if (compare(key, x->GetData<Key>()))
+        {
+            result = x;
+            x = x->left;
+        }
+        else
+            x = x->right;
+    }
+
+    while (result != NIL && result->IsTombstone())
+        result = Successor(result);
+    return const_iterator(result, this);
+}
+
+template<typename Key, typename Compare>
+std::pair<Node*, bool> RedBlackTree::FindOrInsert(const Key& key)
+{
+    Compare compare;
+    Node* x = root;
+    Node* y = NIL;
+    bool isLeft = true;
+
+    while (x != NIL)
+    {
+        y = x;
+        if (compare(key, x->GetData<Key>()))
+        {
+            isLeft = true;
+            x = x->left;
+        }
+        else if (compare(x->GetData<Key>(), key))
+        {
+            isLeft = false;
+            x = x->right;
+        }
+        else if (x->IsTombstone())
+        {
+            // A deleted key of a map comes back as a new entry.
+            Revive(x);
+            x->value.reset();
+            return { x, true };
+        }
+        else
+            return { x, false };
+    }
+
+    Node* z = pool->Create(key, Color::RED);
+    RBT_EMIT(CreateNodeSignal(z));
+
+    LinkNode(z, y, isLeft);
+    return { z, true };
+}
+
+inline void RedBlackTree::OnRecolor(Node* node, Color color)
+{
+    RBT_EMIT(ChangeColorSignal(node, color));
+}
+
+inline void RedBlackTree::OnRotate(Node* x, Node* y, bool isLeft)
+{
+    RBT_EMIT(MoveStartSignal(x, y, !isLeft, isLeft));
+}
+
+inline void RedBlackTree::OnRaise(Node* y, Node* to, bool leftChild, bool isLeft, bool isRoot)
+{
+    RBT_EMIT(MoveYSignal(y, to, leftChild, isLeft, isRoot));
+}
+
+inline void RedBlackTree::OnLower(Node* x, Node* y, bool isLeft)
+{
+    RBT_EMIT(MoveXSignal(x, y, isLeft));
+}
+
+inline void RedBlackTree::OnRotated(Node* x, bool isLeft)
+{
+    if (isLeft)
+        RBT_EMIT(LeftRotateSignal(x));
+    else
+        RBT_EMIT(RightRotateSignal(x));
+}
+
+inline void RedBlackTree::OnSetParent(Node* node, Node* parent)
+{
+    RBT_EMIT(ChangeParentSignal(node, parent));
+}
+
+inline void RedBlackTree::OnSetChild(Node* node, Node* child, bool leftChild)
+{
+    RBT_EMIT(ChangeSiblingSignal(node, child, leftChild));
+}
+
+inline void RedBlackTree::OnTransplant(Node* v, Node* to, bool leftChild, bool isRoot)
+{
+    RBT_EMIT(TransplantSignal(v, to, leftChild, isRoot));
+}
+
+inline void RedBlackTree::OnUnlink(Node* z)
+{
+    RBT_EMIT(DeleteSignal(z));
+}
+
 #endif // REDBLACKTREE_H
@@ -1,6 +1,16 @@
 #include "redblacktree.h"
+#include "redblackmap.h"
+#include "redblackcore.h"
 #include <QTest>
 #include <QDir>
+#include <QRandomGenerator>
+#include <algorithm>
+#include <climits>
+#include <numeric>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
 
 class TestRedBlackTree : public QObject
 {
@@ -13,6 +23,30 @@ private slots:
     void TestXmlFileHandling();
     void TestInsert();
     void TestDelete();
+    void TestNodePool();
+    void TestSentinelUntouched();
+    void TestTreeMetrics();
+    void TestOrderStatistics();
+    void TestRangeAggregate();
+    void TestIntervalTree();
+    void TestIterators();
+    void TestRangeOperations();
+    void TestBuildFromSorted();
+    void TestBatchOperations();
+    void TestJoinSplit();
+    void TestSetOperations();
+    void TestMultiset();
+    void TestRedBlackMap();
+    void TestTypedLookup();
+    void TestTrace();
+    void TestCore();
+    void TestExtremes();
+    void TestInsertHinted();
+    void TestHashIndex();
+    void TestLazyDelete();
+    void TestRelaxedBalance();
+    void BenchmarkUnion();
+    void BenchmarkNaiveUnion();
 };
 
 
@@ -47,5 +81,1397 @@ void TestRedBlackTree::TestDelete()
     QVERIFY(redBlackTree.Delete("5"));
 }
 
+void TestRedBlackTree::TestNodePool()
+{
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+
+    for (int i = 0; i < 1000; ++i)
+        tree.Insert(QString::number(i));
+
+    auto stats = tree.GetPoolStatistics();
+    QCOMPARE(stats.liveNodes, std::size_t(1000));
+    QVERIFY(stats.capacity >= stats.liveNodes);
+
+    QVERIFY(tree.Delete("500"));
+    QCOMPARE(tree.GetPoolStatistics().liveNodes, std::size_t(999));
+
+    // The freed slot is reused instead of growing the pool.
+    tree.Insert("500");
+    QCOMPARE(tree.GetPoolStatistics().capacity, stats.capacity);
+
+    tree = RedBlackTree();
+    QCOMPARE(tree.GetPoolStatistics().capacity, std::size_t(0));
+}
+
+void TestRedBlackTree::TestSentinelUntouched()
+{
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+
+    for (int i = 0; i < 500; ++i)
+        tree.Insert(QString::number((i * 37) % 500));
+    for (int i = 0; i < 500; i += 3)
+        QVERIFY(tree.Delete(QString::number(i)));
+    while (tree.GetRoot() != NIL)
+        QVERIFY(tree.Delete(tree.GetRoot()->GetDataString()));
+
+    // An empty file imports as a tree whose root is NIL.
+    QFile file(QDir::currentPath() + "/empty.txt");
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Text));
+    QTextStream(&file) << "N\nNIL\n";
+    file.close();
+    QVERIFY(tree.ImportTree(QDir::currentPath() + "/empty.txt"));
+    QCOMPARE(tree.GetNodeCount(), quint64(0));
+
+    // Trees in different threads share NIL, so no operation may write to it.
+    QVERIFY(NIL->parent == nullptr);
+    QVERIFY(NIL->left == nullptr && NIL->right == nullptr);
+    QVERIFY(NIL->color == Color::BLACK);
+    QCOMPARE(NIL->size, quint64(0));
+}
+
+void TestRedBlackTree::TestTreeMetrics()
+{
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+
+    for (int i = 0; i < 5000; ++i)
+        tree.Insert(QString::number(i));
+
+    QCOMPARE(tree.GetNodeCount(), quint64(5000));
+    QVERIFY(tree.GetHeight() <= tree.GetHeightBound());
+
+    for (int i = 0; i < 5000; i += 2)
+        QVERIFY(tree.Delete(QString::number(i)));
+
+    QCOMPARE(tree.GetNodeCount(), quint64(2500));
+    QVERIFY(tree.GetHeight() <= tree.GetHeightBound());
+
+    QVERIFY(tree.ImportTree(QDir::currentPath() + "/rbtree.json"));
+    QCOMPARE(tree.GetNodeCount(), quint64(9));
+    QCOMPARE(tree.GetHeight(), quint32(4));
+}
+
+void TestRedBlackTree::TestOrderStatistics()
+{
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+
+    QRandomGenerator generator(42);
+    std::vector<int> oracle;
+
+    for (int i = 0; i < 2000; ++i)
+    {
+        int key = generator.bounded(-500, 500);
+        tree.Insert(QString::number(key));
+        oracle.insert(std::upper_bound(oracle.begin(), oracle.end(), key), key);
+
+        if (i % 3 == 0)
+        {
+            int removed = oracle[generator.bounded(int(oracle.size()))];
+            QVERIFY(tree.Delete(QString::number(removed)));
+            oracle.erase(std::lower_bound(oracle.begin(), oracle.end(), removed));
+        }
+    }
+
+    QCOMPARE(tree.GetRoot()->size, quint64(oracle.size()));
+
+    for (size_t k = 0; k < oracle.size(); ++k)
+        QCOMPARE(tree.Select(k)->GetDataString(), QString::number(oracle[k]));
+    QVERIFY(tree.Select(oracle.size()) == NIL);
+
+    for (int key = -510; key <= 510; key += 7)
+    {
+        auto below = std::lower_bound(oracle.begin(), oracle.end(), key) - oracle.begin();
+        QCOMPARE(tree.Rank(QString::number(key)), quint64(below));
+
+        int hi = key + 40;
+        auto inRange = std::upper_bound(oracle.begin(), oracle.end(), hi) - oracle.begin() - below;
+        QCOMPARE(tree.CountRange(QString::number(key), QString::number(hi)), quint64(inRange));
+    }
+
+    QCOMPARE(tree.CountRange("10", "-10"), quint64(0));
+
+    // Each bound is validated on its own, a valid hi must not cover an invalid lo.
+    QCOMPARE(tree.CountRange("abc", "500"), quint64(0));
+    QCOMPARE(tree.CountRange("-500", "abc"), quint64(0));
+}
+
+void TestRedBlackTree::TestRangeAggregate()
+{
+    RedBlackTree sumTree, maxTree, firstTree;
+    // Keeps the leftmost value, associative but not commutative.
+    Aggregate first{ LLONG_MIN, Aggregate::KeyValue, [](qint64 a, qint64 b) { return a == LLONG_MIN ? b : a; } };
+
+    for (RedBlackTree* tree : { &sumTree, &maxTree, &firstTree })
+        tree->SetTreeDataType(DataType::NUMBER);
+
+    sumTree.SetAggregate(Aggregate::Sum());
+    maxTree.SetAggregate(Aggregate::Max([](const Node& node) { return -Aggregate::KeyValue(node); }));
+    firstTree.SetAggregate(first);
+
+    QRandomGenerator generator(7);
+    std::vector<int> oracle;
+
+    for (int i = 0; i < 1500; ++i)
+    {
+        QString key = QString::number(generator.bounded(-1000, 1000));
+        bool remove = i % 4 == 0 && !oracle.empty();
+        if (remove)
+            key = QString::number(oracle[generator.bounded(int(oracle.size()))]);
+
+        for (RedBlackTree* tree : { &sumTree, &maxTree, &firstTree })
+        {
+            if (remove)
+                QVERIFY(tree->Delete(key));
+            else
+                tree->Insert(key);
+        }
+
+        if (remove)
+            oracle.erase(std::lower_bound(oracle.begin(), oracle.end(), key.toInt()));
+        else
+            oracle.insert(std::upper_bound(oracle.begin(), oracle.end(), key.toInt()), key.toInt());
+    }
+
+    for (int lo = -1050; lo <= 1050; lo += 37)
+    {
+        int hi = lo + generator.bounded(300);
+        auto begin = std::lower_bound(oracle.begin(), oracle.end(), lo);
+        auto end = std::upper_bound(oracle.begin(), oracle.end(), hi);
+
+        qint64 sum = std::accumulate(begin, end, qint64(0));
+        qint64 negatedMin = begin != end ? -*begin : LLONG_MIN;
+        qint64 firstKey = begin != end ? *begin : LLONG_MIN;
+
+        QCOMPARE(sumTree.RangeAggregate(QString::number(lo), QString::number(hi)), sum);
+        QCOMPARE(maxTree.RangeAggregate(QString::number(lo), QString::number(hi)), negatedMin);
+        QCOMPARE(firstTree.RangeAggregate(QString::number(lo), QString::number(hi)), firstKey);
+    }
+
+    QCOMPARE(sumTree.RangeAggregate("5", "-5"), qint64(0));
+    QCOMPARE(sumTree.RangeAggregate(QString("abc"), QString("500")), qint64(0));
+    QCOMPARE(maxTree.RangeAggregate(QString("abc"), QString("500")), maxTree.GetAggregate().identity);
+}
+
+void TestRedBlackTree::TestIntervalTree()
+{
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::INTERVAL);
+
+    QRandomGenerator generator(11);
+    std::vector<Interval> intervals;
+
+    for (int i = 0; i < 800; ++i)
+    {
+        qint16 low = generator.bounded(-2000, 2000);
+        Interval interval{ low, qint16(low + generator.bounded(100)) };
+
+        tree.Insert(ConvertToString(interval));
+        intervals.push_back(interval);
+
+        if (i % 5 == 0)
+        {
+            auto removed = intervals.begin() + generator.bounded(int(intervals.size()));
+            QVERIFY(tree.Delete(ConvertToString(*removed)));
+            intervals.erase(removed);
+        }
+    }
+    std::sort(intervals.begin(), intervals.end());
+
+    for (int low = -2100; low < 2100; low += 53)
+    {
+        Interval query{ qint16(low), qint16(low + generator.bounded(60)) };
+
+        QStringList expected;
+        for (const Interval& interval : intervals)
+            if (interval.Overlaps(query))
+                expected.append(ConvertToString(interval));
+
+        QStringList actual;
+        for (const Node* node : tree.FindAllOverlaps(ConvertToString(query)))
+            actual.append(node->GetDataString());
+
+        QCOMPARE(actual, expected);
+
+        const Node* any = tree.FindOverlap(ConvertToString(query));
+        QCOMPARE(any != NIL, !expected.isEmpty());
+        if (any != NIL)
+            QVERIFY(any->GetData<Interval>().Overlaps(query));
+
+        auto stabbed = std::count_if(intervals.begin(), intervals.end(), [low](const Interval& interval) {
+            return interval.low <= low && low <= interval.high;
+        });
+        QCOMPARE(tree.Stab(QString::number(low)).size(), qsizetype(stabbed));
+    }
+
+    for (const char* suffix : { "txt", "json", "xml", "bin" })
+    {
+        QString fileName = QDir::currentPath() + "/intervals." + suffix;
+        QVERIFY(tree.ExportTree(fileName));
+
+        RedBlackTree imported;
+        QVERIFY(imported.ImportTree(fileName));
+        QCOMPARE(imported.GetDataType(), DataType::INTERVAL);
+        QCOMPARE(imported.GetNodeCount(), quint64(intervals.size()));
+        QCOMPARE(imported.Stab("0").size(), tree.Stab("0").size());
+    }
+}
+
+void TestRedBlackTree::TestIterators()
+{
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+    QVERIFY(tree.begin() == tree.end());
+
+    QRandomGenerator generator(3);
+    std::vector<qint16> oracle;
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        qint16 key = generator.bounded(-300, 300);
+        tree.Insert(QString::number(key));
+        oracle.push_back(key);
+    }
+    std::sort(oracle.begin(), oracle.end());
+
+    std::vector<qint16> keys;
+    for (const Node& node : tree)
+        keys.push_back(node.GetData<qint16>());
+    QVERIFY(keys == oracle);
+
+    QCOMPARE(quint64(std::distance(tree.begin(), tree.end())), tree.GetNodeCount());
+
+    auto it = tree.end();
+    for (auto key = oracle.rbegin(); key != oracle.rend(); ++key)
+        QCOMPARE((--it)->GetData<qint16>(), *key);
+    QVERIFY(it == tree.begin());
+
+    for (qint16 key = -310; key <= 310; key += 3)
+    {
+        auto lower = std::lower_bound(oracle.begin(), oracle.end(), key);
+        auto upper = std::upper_bound(oracle.begin(), oracle.end(), key);
+        auto [first, last] = tree.equal_range(key);
+
+        QCOMPARE(std::distance(tree.begin(), tree.lower_bound(key)), std::distance(oracle.begin(), lower));
+        QCOMPARE(std::distance(tree.begin(), tree.upper_bound(key)), std::distance(oracle.begin(), upper));
+        QCOMPARE(std::distance(first, last), std::distance(lower, upper));
+    }
+
+    auto found = std::find_if(tree.begin(), tree.end(), [](const Node& node) { return node.GetData<qint16>() >= 0; });
+    QVERIFY(found == tree.lower_bound(qint16(0)));
+}
+
+void TestRedBlackTree::TestRangeOperations()
+{
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+    std::vector<int> oracle;
+
+    for (int i = 0; i < 3000; ++i)
+    {
+        tree.Insert(QString::number(i % 1500));
+        oracle.insert(std::upper_bound(oracle.begin(), oracle.end(), i % 1500), i % 1500);
+    }
+
+    QStringList visited;
+    tree.ForEachInRange("10", "13", [&visited](const Node& node) { visited.append(node.GetDataString()); });
+    QCOMPARE(visited, QStringList({ "10", "10", "11", "11", "12", "12", "13", "13" }));
+
+    // An invalid bound rejects the whole range, even when the other one is valid.
+    visited.clear();
+    tree.ForEachInRange("abc", "13", [&visited](const Node& node) { visited.append(node.GetDataString()); });
+    QVERIFY(visited.isEmpty());
+    QCOMPARE(tree.DeleteRange(QString("abc"), QString("500")), quint64(0));
+    QCOMPARE(tree.DeleteRange(QString("0"), QString("abc")), quint64(0));
+    QCOMPARE(tree.GetNodeCount(), quint64(oracle.size()));
+
+    // A short range is unlinked node by node, a long one rebuilds the tree.
+    for (auto [lo, hi] : { std::pair(100, 104), std::pair(-50, 1200), std::pair(1400, 1400), std::pair(5, 3) })
+    {
+        auto first = std::lower_bound(oracle.begin(), oracle.end(), lo);
+        auto last = std::upper_bound(oracle.begin(), oracle.end(), hi);
+        quint64 expected = lo <= hi ? last - first : 0;
+        if (lo <= hi)
+            oracle.erase(first, last);
+
+        QCOMPARE(tree.DeleteRange(QString::number(lo), QString::number(hi)), expected);
+        QCOMPARE(tree.GetNodeCount(), quint64(oracle.size()));
+        QCOMPARE(tree.GetRoot()->size, quint64(oracle.size()));
+        QVERIFY(tree.GetRoot()->GetBlackHeight() >= 0);
+
+        std::vector<int> keys;
+        for (const Node& node : tree)
+        {
+            keys.push_back(node.GetData<qint16>());
+            QVERIFY(node.color == Color::BLACK || node.parent->color == Color::BLACK);
+        }
+        QVERIFY(keys == oracle);
+    }
+
+    tree.Insert("1250");
+    QVERIFY(tree.Find("1250"));
+    QVERIFY(tree.Delete("1300"));
+}
+
+void TestRedBlackTree::TestBuildFromSorted()
+{
+    for (int n : { 0, 1, 2, 7, 8, 100, 1023, 4097 })
+    {
+        QStringList keys;
+        for (int i = 0; i < n; ++i)
+            keys.append(QString::number(i - n / 2));
+
+        RedBlackTree tree;
+        tree.SetTreeDataType(DataType::NUMBER);
+        QVERIFY(tree.BuildFromSorted(keys));
+
+        QCOMPARE(tree.GetNodeCount(), quint64(n));
+        QVERIFY(tree.GetHeight() <= tree.GetHeightBound());
+        QVERIFY(tree.GetRoot()->color == Color::BLACK);
+        QVERIFY(tree.GetRoot()->GetBlackHeight() >= 0);
+
+        QStringList visited;
+        for (const Node& node : tree)
+        {
+            visited.append(node.GetDataString());
+            QVERIFY(node.color == Color::BLACK || node.parent->color == Color::BLACK);
+        }
+        QCOMPARE(visited, keys);
+
+        tree.Insert("0");
+        QCOMPARE(tree.GetNodeCount(), quint64(n + 1));
+    }
+
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+    QVERIFY(!tree.BuildFromSorted({ "2", "1" }));
+
+    // Key lists may be unsorted, the import orders them.
+    QFile file(QDir::currentPath() + "/rbtree.keys");
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Text));
+    QTextStream(&file) << "t\nkiwi\napp\n\nfig\nbe\n";
+    file.close();
+
+    QVERIFY(tree.ImportTree(QDir::currentPath() + "/rbtree.keys"));
+    QCOMPARE(tree.GetDataType(), DataType::TEXT);
+    QCOMPARE(tree.GetNodeCount(), quint64(4));
+    QVERIFY(tree.ExportTree(QDir::currentPath() + "/rbtree2.keys"));
+
+    RedBlackTree reimported;
+    QVERIFY(reimported.ImportTree(QDir::currentPath() + "/rbtree2.keys"));
+    QCOMPARE(reimported.Select(0)->GetDataString(), QString("app"));
+    QCOMPARE(reimported.Select(3)->GetDataString(), QString("kiwi"));
+}
+
+void TestRedBlackTree::TestBatchOperations()
+{
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+    QRandomGenerator generator(5);
+    std::vector<int> oracle;
+
+    // Alternates between batches that are large and small next to the tree.
+    for (int size : { 5000, 20, 3000, 7, 9000 })
+    {
+        QStringList inserted, deleted;
+        for (int i = 0; i < size; ++i)
+        {
+            int key = generator.bounded(-9999, 10000);
+            inserted.append(QString::number(key));
+            oracle.push_back(key);
+        }
+        QVERIFY(tree.InsertBatch(inserted));
+        std::sort(oracle.begin(), oracle.end());
+
+        quint64 expected = 0;
+        for (int i = 0; i < size / 2; ++i)
+        {
+            int key = i % 2 ? oracle[generator.bounded(int(oracle.size()))] : generator.bounded(-9999, 10000);
+            deleted.append(QString::number(key));
+
+            auto it = std::lower_bound(oracle.begin(), oracle.end(), key);
+            if (it != oracle.end() && *it == key)
+            {
+                oracle.erase(it);
+                ++expected;
+            }
+        }
+        QCOMPARE(tree.DeleteBatch(deleted), expected);
+
+        QCOMPARE(tree.GetNodeCount(), quint64(oracle.size()));
+        QCOMPARE(tree.GetRoot()->size, quint64(oracle.size()));
+        QVERIFY(tree.GetRoot()->GetBlackHeight() >= 0);
+
+        std::vector<int> keys;
+        for (const Node& node : tree)
+        {
+            keys.push_back(node.GetData<qint16>());
+            QVERIFY(node.color == Color::BLACK || node.parent->color == Color::BLACK);
+        }
+        QVERIFY(keys == oracle);
+    }
+
+    QVERIFY(!tree.InsertBatch({ "1", "abc" }));
+    QCOMPARE(tree.GetNodeCount(), quint64(oracle.size()));
+
+    RedBlackTree text;
+    text.SetTreeDataType(DataType::TEXT);
+    QVERIFY(text.InsertBatch({ "pear", "fig", "app", "fig" }));
+    QCOMPARE(text.DeleteBatch({ "fig", "kiwi" }), quint64(1));
+    QCOMPARE(text.Rank("pear"), quint64(2));
+}
+
+void TestRedBlackTree::TestJoinSplit()
+{
+    auto keysOf = [](const RedBlackTree& tree) {
+        std::vector<int> keys;
+        for (const Node& node : tree)
+            keys.push_back(node.GetData<qint16>());
+        return keys;
+    };
+    auto isValid = [](const RedBlackTree& tree) {
+        if (tree.GetRoot()->color != Color::BLACK || tree.GetRoot()->GetBlackHeight() < 0)
+            return false;
+        if (tree.GetRoot()->size != tree.GetNodeCount())
+            return false;
+        for (const Node& node : tree)
+        {
+            if (node.color == Color::RED && node.parent->color == Color::RED)
+                return false;
+            if (node.size != node.left->size + node.right->size + 1)
+                return false;
+            if ((node.left != NIL && node.left->parent != &node) || (node.right != NIL && node.right->parent != &node))
+                return false;
+        }
+        return true;
+    };
+
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+    tree.SetAggregate(Aggregate::Sum());
+    QRandomGenerator generator(12);
+    std::vector<int> oracle;
+
+    QStringList keys;
+    for (int i = 0; i < 3000; ++i)
+    {
+        int key = generator.bounded(-5000, 5000);
+        keys.append(QString::number(key));
+        oracle.push_back(key);
+    }
+    QVERIFY(tree.InsertBatch(keys));
+    std::sort(oracle.begin(), oracle.end());
+
+    for (int key : { -6000, -5000, -1, 0, 17, 2500, 4999, 6000 })
+    {
+        RedBlackTree left, right;
+        QVERIFY(tree.Split(QString::number(key), left, right));
+        QCOMPARE(tree.GetNodeCount(), quint64(0));
+        QVERIFY(isValid(left));
+        QVERIFY(isValid(right));
+
+        auto middle = std::lower_bound(oracle.begin(), oracle.end(), key);
+        QVERIFY(keysOf(left) == std::vector<int>(oracle.begin(), middle));
+        QVERIFY(keysOf(right) == std::vector<int>(middle, oracle.end()));
+        QCOMPARE(left.RangeAggregate("-5000", "5000"), std::accumulate(oracle.begin(), middle, qint64(0)));
+
+        QVERIFY(tree.Join(left, right));
+        QCOMPARE(left.GetNodeCount() + right.GetNodeCount(), quint64(0));
+        QVERIFY(isValid(tree));
+        QVERIFY(keysOf(tree) == oracle);
+    }
+
+    // Splitting into itself keeps the lower half, a pivot join puts the key back between.
+    RedBlackTree upper;
+    QVERIFY(tree.Split("100", tree, upper));
+    QVERIFY(tree.Join(tree, "100", upper));
+    oracle.insert(std::lower_bound(oracle.begin(), oracle.end(), 100), 100);
+    QVERIFY(isValid(tree));
+    QVERIFY(keysOf(tree) == oracle);
+    QCOMPARE(tree.RangeAggregate("-5000", "5000"), std::accumulate(oracle.begin(), oracle.end(), qint64(0)));
+
+    // Trees of very different heights built in separate pools.
+    RedBlackTree small, large;
+    small.SetTreeDataType(DataType::NUMBER);
+    large.SetTreeDataType(DataType::NUMBER);
+    small.Insert("-9000");
+    QStringList largeKeys;
+    for (int i = 0; i < 5000; ++i)
+        largeKeys.append(QString::number(i));
+    QVERIFY(large.BuildFromSorted(largeKeys));
+
+    RedBlackTree joined;
+    QVERIFY(joined.Join(small, "-10", large));
+    QVERIFY(isValid(joined));
+    QCOMPARE(joined.GetNodeCount(), quint64(5002));
+    QCOMPARE(joined.GetPoolStatistics().liveNodes, std::size_t(5002));
+
+    QVERIFY(!joined.Join(tree, "0", joined));
+    QVERIFY(!tree.Join(tree, "7000", joined));
+    QCOMPARE(tree.GetNodeCount(), quint64(oracle.size()));
+
+    // Halves of a text tree release their keys independently.
+    RedBlackTree text, first, second;
+    text.SetTreeDataType(DataType::TEXT);
+    QVERIFY(text.InsertBatch({ "pear", "fig", "app", "kiwi", "bean" }));
+    QVERIFY(text.Split("fig", first, second));
+    QCOMPARE(first.GetNodeCount(), quint64(2));
+    QCOMPARE(second.Select(0)->GetDataString(), QString("fig"));
+    first = RedBlackTree();
+    second.Insert("plum");
+    QCOMPARE(second.GetNodeCount(), quint64(4));
+
+    // Multisets sharing a boundary key keep a single node for it.
+    RedBlackTree bag, lowBag, highBag;
+    for (RedBlackTree* part : { &bag, &lowBag, &highBag })
+    {
+        part->SetTreeDataType(DataType::NUMBER);
+        QVERIFY(part->SetMultiset(true));
+    }
+    QVERIFY(lowBag.InsertBatch({ "1", "5" }));
+    QVERIFY(highBag.InsertBatch({ "5", "5", "9" }));
+    QVERIFY(bag.Join(lowBag, highBag));
+    QVERIFY(isValid(bag));
+    QCOMPARE(bag.GetNodeCount(), quint64(3));
+    QCOMPARE(bag.Count("5"), quint64(3));
+    bag.Insert("5");
+    QCOMPARE(bag.Count("5"), quint64(4));
+    QCOMPARE(bag.GetNodeCount(), quint64(3));
+    QCOMPARE(bag.GetPoolStatistics().liveNodes, std::size_t(3));
+
+    QVERIFY(bag.Split("9", lowBag, highBag));
+    QVERIFY(bag.Join(lowBag, "5", highBag));
+    QVERIFY(isValid(bag));
+    QCOMPARE(bag.GetNodeCount(), quint64(3));
+    QCOMPARE(bag.Count("5"), quint64(5));
+
+    QVERIFY(bag.Split("5", lowBag, highBag));
+    QVERIFY(bag.Join(lowBag, "5", highBag));
+    QCOMPARE(bag.GetNodeCount(), quint64(3));
+    QCOMPARE(bag.Count("5"), quint64(6));
+
+    // Halves have pools of their own, so they can be changed from different threads.
+    RedBlackTree source, lower, higher;
+    source.SetTreeDataType(DataType::NUMBER);
+    source.SetLazyDelete(true, 0.5);
+    QStringList sorted;
+    for (int i = 0; i < 4000; ++i)
+        sorted.append(QString::number(i));
+    QVERIFY(source.BuildFromSorted(sorted));
+    QVERIFY(source.Split("2000", lower, higher));
+    QVERIFY(lower.IsLazyDelete() && higher.IsLazyDelete());
+    QCOMPARE(source.GetPoolStatistics().capacity, std::size_t(0));
+    QCOMPARE(lower.GetPoolStatistics().liveNodes, std::size_t(2000));
+    QCOMPARE(higher.GetPoolStatistics().liveNodes, std::size_t(2000));
+
+    auto churn = [](RedBlackTree* tree, int first, int offset) {
+        for (int i = first; i < first + 2000; ++i)
+        {
+            tree->Delete(qint16(i));
+            tree->Insert(qint16(i + offset));
+        }
+    };
+    std::thread worker(churn, &lower, 0, -5000);
+    churn(&higher, 2000, 5000);
+    worker.join();
+
+    for (RedBlackTree* tree : { &lower, &higher })
+    {
+        QCOMPARE(tree->GetNodeCount(), quint64(2000));
+        QCOMPARE(quint64(tree->GetPoolStatistics().liveNodes), tree->GetNodeCount() + tree->GetTombstoneCount());
+    }
+    QCOMPARE(std::get<qint16>(lower.Max()->data), qint16(-3001));
+    QCOMPARE(std::get<qint16>(higher.Min()->data), qint16(7000));
+
+    QVERIFY(source.Join(lower, higher));
+    QVERIFY(isValid(source));
+    QCOMPARE(source.GetNodeCount(), quint64(4000));
+    QCOMPARE(source.GetPoolStatistics().liveNodes, std::size_t(4000));
+
+    // A split map keeps exporting its payloads.
+    RedBlackMap map;
+    for (int i = 0; i < 100; ++i)
+        map.InsertOrAssign(QString::number(i), i);
+    RedBlackTree mapLower, mapUpper;
+    QVERIFY(map.Split("50", mapLower, mapUpper));
+    QString fileName = QDir::currentPath() + "/splitmap.json";
+    QVERIFY(mapUpper.ExportTree(fileName));
+    RedBlackMap imported;
+    QVERIFY(imported.ImportTree(fileName));
+    QCOMPARE(imported.FindValue("70")->toInt(), 70);
+}
+
+void TestRedBlackTree::TestSetOperations()
+{
+    // Distinct random keys, the larger sets go through the thread pool.
+    auto randomKeys = [](QRandomGenerator& generator, int count) {
+        std::vector<int> keys;
+        for (int i = 0; i < count; ++i)
+            keys.push_back(generator.bounded(-9999, 10000));
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        return keys;
+    };
+    auto makeTree = [](RedBlackTree& tree, const std::vector<int>& keys) {
+        QStringList list;
+        for (int key : keys)
+            list.append(QString::number(key));
+        tree.SetTreeDataType(DataType::NUMBER);
+        return tree.BuildFromSorted(list);
+    };
+
+    QRandomGenerator generator(13);
+
+    for (auto [firstCount, secondCount] : { std::pair(0, 50), std::pair(50, 0), std::pair(300, 20), std::pair(12000, 15000), std::pair(18000, 300) })
+    {
+        auto firstKeys = randomKeys(generator, firstCount);
+        auto secondKeys = randomKeys(generator, secondCount);
+
+        for (int operation = 0; operation < 3; ++operation)
+        {
+            RedBlackTree first, second;
+            QVERIFY(makeTree(first, firstKeys));
+            QVERIFY(makeTree(second, secondKeys));
+
+            std::vector<int> expected;
+            if (operation == 0)
+            {
+                QVERIFY(first.Union(second));
+                std::set_union(firstKeys.begin(), firstKeys.end(), secondKeys.begin(), secondKeys.end(), std::back_inserter(expected));
+            }
+            else if (operation == 1)
+            {
+                QVERIFY(first.Intersection(second));
+                std::set_intersection(firstKeys.begin(), firstKeys.end(), secondKeys.begin(), secondKeys.end(), std::back_inserter(expected));
+            }
+            else
+            {
+                QVERIFY(first.Difference(second));
+                std::set_difference(firstKeys.begin(), firstKeys.end(), secondKeys.begin(), secondKeys.end(), std::back_inserter(expected));
+            }
+
+            QCOMPARE(second.GetNodeCount(), quint64(0));
+            QCOMPARE(first.GetNodeCount(), quint64(expected.size()));
+            QCOMPARE(first.GetPoolStatistics().liveNodes, std::size_t(expected.size()));
+            QVERIFY(first.GetRoot()->color == Color::BLACK);
+            QVERIFY(first.GetRoot()->GetBlackHeight() >= 0);
+
+            std::vector<int> keys;
+            for (const Node& node : first)
+            {
+                keys.push_back(node.GetData<qint16>());
+                QVERIFY(node.color == Color::BLACK || node.parent->color == Color::BLACK);
+                QCOMPARE(node.size, node.left->size + node.right->size + 1);
+            }
+            QVERIFY(keys == expected);
+        }
+    }
+
+    RedBlackTree text, numbers;
+    text.SetTreeDataType(DataType::TEXT);
+    numbers.SetTreeDataType(DataType::NUMBER);
+    QVERIFY(!text.Union(numbers));
+    QVERIFY(!text.Union(text));
+}
+
+void TestRedBlackTree::TestMultiset()
+{
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+    QVERIFY(tree.SetMultiset(true));
+
+    for (int i = 0; i < 1000; ++i)
+        tree.Insert(QString::number(i % 10));
+
+    QCOMPARE(tree.GetNodeCount(), quint64(10));
+    QCOMPARE(tree.Count("3"), quint64(100));
+    QCOMPARE(tree.Count("42"), quint64(0));
+    QVERIFY(!tree.SetMultiset(false));
+
+    QVERIFY(tree.Delete("3"));
+    QCOMPARE(tree.Count("3"), quint64(99));
+    QCOMPARE(tree.GetNodeCount(), quint64(10));
+
+    // Large batches are merged into the counts of the existing nodes.
+    QStringList batch;
+    for (int i = 0; i < 500; ++i)
+        batch.append(QString::number(i % 20));
+    QVERIFY(tree.InsertBatch(batch));
+    QCOMPARE(tree.GetNodeCount(), quint64(20));
+    QCOMPARE(tree.Count("3"), quint64(124));
+    QCOMPARE(tree.Count("15"), quint64(25));
+    QCOMPARE(tree.DeleteBatch(QStringList(30, "15")), quint64(25));
+    QCOMPARE(tree.Count("15"), quint64(0));
+    QCOMPARE(tree.GetNodeCount(), quint64(19));
+
+    for (const QString& suffix : QStringList({ "txt", "bin", "json", "xml", "keys" }))
+    {
+        QString fileName = QDir::currentPath() + "/multiset." + suffix;
+        QVERIFY(tree.ExportTree(fileName));
+
+        RedBlackTree imported;
+        QVERIFY(imported.ImportTree(fileName));
+        QVERIFY(imported.IsMultiset());
+        QCOMPARE(imported.Count("3"), quint64(124));
+        QCOMPARE(imported.Count("19"), quint64(25));
+    }
+
+    // Multiplicities add up in a union and take the smaller side in an intersection.
+    RedBlackTree other;
+    other.SetTreeDataType(DataType::NUMBER);
+    QVERIFY(other.SetMultiset(true));
+    other.Insert("3");
+    other.Insert("3");
+    other.Insert("50");
+
+    RedBlackTree copy;
+    QVERIFY(copy.ImportTree(QDir::currentPath() + "/multiset.json"));
+    QVERIFY(copy.Intersection(other));
+    QCOMPARE(copy.GetNodeCount(), quint64(1));
+    QCOMPARE(copy.Count("3"), quint64(2));
+    QCOMPARE(other.GetNodeCount(), quint64(0));
+
+    other.Insert("3");
+    other.Insert("50");
+    QVERIFY(tree.Union(other));
+    QCOMPARE(tree.Count("3"), quint64(125));
+    QCOMPARE(tree.Count("50"), quint64(1));
+    QCOMPARE(tree.GetNodeCount(), quint64(20));
+
+    RedBlackTree plain;
+    plain.SetTreeDataType(DataType::NUMBER);
+    plain.Insert("3");
+    plain.Insert("3");
+    QCOMPARE(plain.Count("3"), quint64(2));
+    QVERIFY(!tree.Union(plain));
+}
+
+void TestRedBlackTree::TestRedBlackMap()
+{
+    RedBlackMap map;
+    map.SetTreeDataType(DataType::TEXT);
+
+    QVERIFY(map.InsertOrAssign("fig", 3));
+    QVERIFY(map.InsertOrAssign("pear", QString("green")));
+    QCOMPARE(map.InsertOrAssign("fig", 4)->toInt(), 4);
+    QVERIFY(!map.InsertOrAssign("melon", 1));
+    QCOMPARE(map.GetNodeCount(), quint64(2));
+
+    auto [value, isInserted] = map.TryEmplace("fig", 5);
+    QVERIFY(!isInserted);
+    QCOMPARE(value->toInt(), 4);
+    QVERIFY(map.TryEmplace("kiwi", true).second);
+
+    QVERIFY(map.FindValue("plum") == nullptr);
+    QCOMPARE(map.FindValue("pear")->toString(), QString("green"));
+    *map.FindValue("pear") = QString("ripe");
+
+    for (int i = 0; i < 200; ++i)
+        map.InsertOrAssign(QString::number(i), i);
+    QCOMPARE(map.GetNodeCount(), quint64(203));
+    QVERIFY(map.GetRoot()->GetBlackHeight() >= 0);
+    QCOMPARE(map.GetRoot()->size, quint64(203));
+
+    for (const QString& suffix : QStringList({ "bin", "json", "xml" }))
+    {
+        QString fileName = QDir::currentPath() + "/map." + suffix;
+        QVERIFY(map.ExportTree(fileName));
+
+        RedBlackMap imported;
+        QVERIFY(imported.ImportTree(fileName));
+        QCOMPARE(imported.GetNodeCount(), quint64(203));
+        QCOMPARE(imported.FindValue("pear")->toString(), QString("ripe"));
+        QCOMPARE(imported.FindValue("fig")->toInt(), 4);
+        QCOMPARE(imported.FindValue("150")->toInt(), 150);
+
+        // Payloads keep their type, JSON would turn integers into doubles otherwise.
+        QCOMPARE(QString(imported.FindValue("150")->typeName()), QString("int"));
+        QCOMPARE(QString(imported.FindValue("kiwi")->typeName()), QString("bool"));
+    }
+
+    // Plain trees don't allocate payloads.
+    RedBlackTree plain;
+    plain.SetTreeDataType(DataType::NUMBER);
+    plain.Insert("1");
+    QVERIFY(!plain.GetRoot()->value);
+
+    // Moving a map into a plain tree keeps its payloads in the export.
+    RedBlackMap source;
+    QVERIFY(source.ImportTree(QDir::currentPath() + "/map.json"));
+    RedBlackTree moved;
+    moved = std::move(source);
+    QCOMPARE(moved.GetNodeCount(), quint64(203));
+    QVERIFY(moved.ExportTree(QDir::currentPath() + "/moved.json"));
+
+    RedBlackMap reimported;
+    QVERIFY(reimported.ImportTree(QDir::currentPath() + "/moved.json"));
+    QCOMPARE(reimported.FindValue("pear")->toString(), QString("ripe"));
+    QCOMPARE(reimported.FindValue("150")->toInt(), 150);
+}
+
+void TestRedBlackTree::TestTypedLookup()
+{
+    RedBlackTree numbers;
+    numbers.SetTreeDataType(DataType::NUMBER);
+    for (qint16 i = -50; i < 50; ++i)
+        numbers.Insert(i);
+
+    QCOMPARE(numbers.GetNodeCount(), quint64(100));
+    QVERIFY(numbers.Find(qint16(-50)));
+    QVERIFY(numbers.Find("49"));
+    QVERIFY(!numbers.Find(qint16(50)));
+    QVERIFY(!numbers.Find(QChar('a')));
+    QVERIFY(numbers.Delete(qint16(7)));
+    QVERIFY(!numbers.Delete(qint16(7)));
+    numbers.Insert(qint16(UPPER_BOUND));
+    QCOMPARE(numbers.GetNodeCount(), quint64(99));
+
+    RedBlackTree chars;
+    chars.SetTreeDataType(DataType::CHAR);
+    chars.Insert(QChar('q'));
+    QVERIFY(chars.Find(QChar('q')));
+    QVERIFY(chars.Delete(QChar('q')));
+    QCOMPARE(chars.GetNodeCount(), quint64(0));
+
+    RedBlackTree texts;
+    texts.SetTreeDataType(DataType::TEXT);
+    const QString stored = "abcdefgh";
+    texts.Insert(QStringView(stored).mid(0, 4));
+    texts.Insert(QLatin1StringView("fig"));
+    texts.Insert("kiwi");
+    QCOMPARE(texts.GetNodeCount(), quint64(3));
+
+    QVERIFY(texts.Find(QStringView(stored).mid(0, 4)));
+    QVERIFY(texts.Find(QLatin1StringView("kiwi")));
+    QVERIFY(!texts.Find(QStringView(stored).mid(1, 4)));
+    QVERIFY(!texts.Find(QLatin1StringView("plums")));
+    QVERIFY(texts.Delete(QLatin1StringView("fig")));
+    QVERIFY(texts.Delete(QStringView(stored).mid(0, 4)));
+    QVERIFY(!texts.Find("abcd"));
+    QCOMPARE(texts.GetNodeCount(), quint64(1));
+}
+
+void TestRedBlackTree::TestTrace()
+{
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+    QVERIFY(tree.GetTrace() == nullptr);
+
+    tree.EnableTrace(100);
+    QCOMPARE(tree.GetTrace()->Capacity(), std::size_t(128));
+
+    tree.Insert("1");
+    tree.Insert("2");
+    tree.Insert("3");
+
+    std::vector<TraceEvent> events;
+    QVERIFY(tree.GetTrace()->Drain(events) > 0);
+    QCOMPARE(tree.GetTrace()->Size(), std::size_t(0));
+    QVERIFY(events.front().op == TraceOp::CreateNode);
+    QCOMPARE(std::count_if(events.begin(), events.end(), [](const TraceEvent& event) {
+        return event.op == TraceOp::CreateNode;
+    }), std::ptrdiff_t(3));
+    QVERIFY(std::any_of(events.begin(), events.end(), [](const TraceEvent& event) {
+        return event.op == TraceOp::LeftRotate;
+    }));
+
+    for (int i = 4; i < 200; ++i)
+        tree.Insert(QString::number(i));
+    QCOMPARE(tree.GetTrace()->Size(), std::size_t(128));
+    QVERIFY(tree.GetTrace()->Dropped() > 0);
+    QVERIFY(tree.GetTrace()->Dump(QDir::currentPath() + "/rbtree.trace"));
+    QCOMPARE(tree.GetTrace()->Size(), std::size_t(0));
+
+    tree.DisableTrace();
+    tree.Insert("200");
+    QVERIFY(tree.GetTrace() == nullptr);
+}
+
+void TestRedBlackTree::TestCore()
+{
+    RedBlackCore<int> core;
+    std::set<int> oracle;
+    QRandomGenerator random(17);
+
+    for (int i = 0; i < 3000; ++i)
+    {
+        int key = random.bounded(1000);
+        if (random.bounded(3) == 0)
+            QCOMPARE(core.Erase(key), oracle.erase(key) == 1);
+        else
+            QCOMPARE(core.Insert(key).second, oracle.insert(key).second);
+    }
+
+    QVERIFY(core.IsValid());
+    QCOMPARE(core.Size(), oracle.size());
+
+    std::size_t k = 0;
+    auto expected = oracle.begin();
+    for (const auto* node = core.First(); node; node = RedBlackCore<int>::Next(node), ++expected, ++k)
+    {
+        QCOMPARE(node->key, *expected);
+        QCOMPARE(core.Select(k), node);
+        QCOMPARE(core.Rank(node->key), k);
+    }
+    QCOMPARE(k, oracle.size());
+    QVERIFY(core.Select(k) == nullptr);
+
+    RedBlackCore<std::string, std::less<>> words;
+    words.Insert("pear");
+    words.Insert("fig");
+    QVERIFY(words.Find(std::string_view("fig")) != nullptr);
+    QVERIFY(words.Find("kiwi") == nullptr);
+    words.Erase(words.Find("pear"));
+    QCOMPARE(words.Size(), std::size_t(1));
+
+    RedBlackCore<int> moved = std::move(core);
+    QVERIFY(core.IsEmpty());
+    QCOMPARE(moved.Size(), oracle.size());
+    moved.Clear();
+    QVERIFY(moved.IsEmpty() && moved.IsValid());
+}
+
+void TestRedBlackTree::TestExtremes()
+{
+    auto extremesMatch = [](const RedBlackTree& tree) {
+        if (tree.GetRoot() == NIL)
+            return tree.Min() == NIL && tree.Max() == NIL;
+        return tree.Min() == &*tree.begin() && tree.Max() == &*std::prev(tree.end()) &&
+               tree.Min()->left == NIL && tree.Max()->right == NIL;
+    };
+
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+    QVERIFY(!tree.ExtractMin().has_value());
+    QVERIFY(extremesMatch(tree));
+
+    std::multiset<int> oracle;
+    QRandomGenerator random(5);
+    for (int i = 0; i < 2000; ++i)
+    {
+        int key = random.bounded(400);
+        switch (random.bounded(4))
+        {
+        case 0:
+            if (!oracle.empty())
+            {
+                QCOMPARE(std::get<qint16>(*tree.ExtractMin()), qint16(*oracle.begin()));
+                oracle.erase(oracle.begin());
+            }
+            break;
+        case 1:
+            if (!oracle.empty())
+            {
+                QCOMPARE(std::get<qint16>(*tree.ExtractMax()), qint16(*oracle.rbegin()));
+                oracle.erase(std::prev(oracle.end()));
+            }
+            break;
+        case 2:
+            if (oracle.erase(key) > 0)
+            {
+                for (std::size_t n = tree.GetNodeCount() - oracle.size(); n > 0; --n)
+                    QVERIFY(tree.Delete(QString::number(key)));
+            }
+            break;
+        default:
+            tree.Insert(QString::number(key));
+            oracle.insert(key);
+        }
+        QVERIFY(extremesMatch(tree));
+    }
+
+    QVERIFY(tree.InsertBatch({ "-500", "900", "3" }));
+    QVERIFY(extremesMatch(tree));
+    QCOMPARE(std::get<qint16>(tree.Min()->data), qint16(-500));
+
+    tree.DeleteRange("-1000", "100");
+    QVERIFY(extremesMatch(tree));
+
+    RedBlackTree upper;
+    QVERIFY(tree.Split("300", tree, upper));
+    QVERIFY(extremesMatch(tree) && extremesMatch(upper));
+    QVERIFY(tree.Join(tree, upper));
+    QVERIFY(extremesMatch(tree) && extremesMatch(upper));
+    QCOMPARE(std::get<qint16>(tree.Max()->data), qint16(900));
+
+    RedBlackTree other;
+    other.SetTreeDataType(DataType::NUMBER);
+    QVERIFY(other.BuildFromSorted({ "-20", "1000" }));
+    QVERIFY(extremesMatch(other));
+    QVERIFY(tree.Union(other));
+    QVERIFY(extremesMatch(tree) && extremesMatch(other));
+    QCOMPARE(std::get<qint16>(tree.Min()->data), qint16(-20));
+
+    while (tree.ExtractMax())
+        QVERIFY(extremesMatch(tree));
+    QCOMPARE(tree.GetNodeCount(), quint64(0));
+}
+
+void TestRedBlackTree::TestInsertHinted()
+{
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+    tree.SetAggregate(Aggregate::Sum());
+
+    const Node* hint = NIL;
+    qint64 sum = 0;
+    for (int i = -2000; i < 2000; ++i)
+    {
+        QString key = QString::number(i);
+        quint32 expectedDepth = tree.GetNewNodeHeight(key);
+        auto result = tree.InsertHinted(hint, key);
+        QCOMPARE(result.depth, expectedDepth);
+        QCOMPARE(result.node->GetData<qint16>(), qint16(i));
+        hint = result.node;
+        sum += i;
+    }
+
+    // Clustered keys around changing fingers, including duplicates of the hint.
+    QRandomGenerator random(21);
+    std::multiset<int> oracle;
+    for (int i = -2000; i < 2000; ++i)
+        oracle.insert(i);
+    for (int i = 0; i < 2000; ++i)
+    {
+        int key = std::clamp(hint->GetData<qint16>() + int(random.bounded(41)) - 20, -9999, 9999);
+        hint = tree.InsertHinted(hint, QString::number(key)).node;
+        oracle.insert(key);
+        sum += key;
+    }
+
+    QCOMPARE(tree.GetNodeCount(), quint64(oracle.size()));
+    QCOMPARE(tree.GetRoot()->size, quint64(oracle.size()));
+    QCOMPARE(tree.GetRoot()->aggregate, sum);
+    QVERIFY(tree.GetRoot()->GetBlackHeight() >= 0);
+    QVERIFY(std::equal(tree.begin(), tree.end(), oracle.begin(), oracle.end(), [](const Node& node, int key) {
+        return node.GetData<qint16>() == key;
+    }));
+    QVERIFY(tree.InsertHinted(hint, "abc").node == NIL);
+
+    RedBlackTree multiset;
+    multiset.SetTreeDataType(DataType::NUMBER);
+    multiset.SetMultiset(true);
+    for (int i = 0; i < 64; ++i)
+        multiset.Insert(QString::number(i));
+    for (const Node& node : multiset)
+    {
+        auto result = multiset.InsertHinted(multiset.Max(), node.GetDataString());
+        QVERIFY(result.node == &node);
+        QCOMPARE(result.depth, quint32(0));
+        QVERIFY(multiset.InsertHinted(multiset.Min(), node.GetDataString()).node == &node);
+    }
+    QCOMPARE(multiset.GetNodeCount(), quint64(64));
+    QCOMPARE(multiset.Count("17"), quint64(3));
+}
+
+void TestRedBlackTree::TestHashIndex()
+{
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+    for (int i = 0; i < 100; ++i)
+        tree.Insert(QString::number(i));
+
+    QVERIFY(!tree.HasHashIndex());
+    tree.SetHashIndex(true);
+    QCOMPARE(tree.GetHashIndexStatistics().entries, std::size_t(100));
+
+    // Duplicates share one entry, which has to survive deleting some of the copies.
+    std::multiset<int> oracle;
+    for (int i = 0; i < 100; ++i)
+        oracle.insert(i);
+    QRandomGenerator random(3);
+    for (int i = 0; i < 3000; ++i)
+    {
+        int key = random.bounded(150);
+        if (random.bounded(2) == 0)
+        {
+            tree.Insert(QString::number(key));
+            oracle.insert(key);
+        }
+        else if (random.bounded(4) == 0 && !oracle.empty())
+        {
+            QCOMPARE(std::get<qint16>(*tree.ExtractMin()), qint16(*oracle.begin()));
+            oracle.erase(oracle.begin());
+        }
+        else
+        {
+            auto it = oracle.find(key);
+            QCOMPARE(tree.Delete(QString::number(key)), it != oracle.end());
+            if (it != oracle.end())
+                oracle.erase(it);
+        }
+        QCOMPARE(tree.Find(QString::number(key)), oracle.count(key) > 0);
+        QCOMPARE(tree.Find(qint16(key + 1)), oracle.count(key + 1) > 0);
+    }
+
+    std::set<int> distinct(oracle.begin(), oracle.end());
+    auto statistics = tree.GetHashIndexStatistics();
+    QCOMPARE(statistics.entries, distinct.size());
+    QCOMPARE(statistics.lookups, quint64(6000));
+    QVERIFY(statistics.hits > 0 && statistics.hits < statistics.lookups);
+    QVERIFY(statistics.buckets >= statistics.entries && statistics.approximateBytes > 0);
+
+    RedBlackTree upper;
+    QVERIFY(tree.Split("75", tree, upper));
+    QVERIFY(!tree.Find("75") && !tree.Find("149"));
+    QCOMPARE(tree.Find("74"), distinct.count(74) > 0);
+    QVERIFY(tree.Join(tree, upper));
+    QCOMPARE(tree.Find("149"), distinct.count(149) > 0);
+    QCOMPARE(tree.GetHashIndexStatistics().entries, distinct.size());
+
+    QVERIFY(tree.BuildFromSorted({ "1", "2", "3" }));
+    QCOMPARE(tree.GetHashIndexStatistics().entries, std::size_t(3));
+    QVERIFY(tree.Find("2") && !tree.Find("4"));
+
+    tree.SetHashIndex(false);
+    QCOMPARE(tree.GetHashIndexStatistics().lookups, quint64(0));
+    QVERIFY(tree.Find("3"));
+
+    RedBlackTree text;
+    text.SetTreeDataType(DataType::TEXT);
+    text.SetHashIndex(true);
+    text.Insert("fig");
+    text.Insert("pear");
+    QVERIFY(text.Find("fig") && !text.Find("Fig"));
+    QVERIFY(text.Find(QLatin1StringView("pear")));
+}
+
+void TestRedBlackTree::TestLazyDelete()
+{
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+    tree.SetAggregate(Aggregate::Sum());
+    tree.SetHashIndex(true);
+    tree.SetLazyDelete(true, 0.5);
+
+    std::multiset<int> oracle;
+    QRandomGenerator random(11);
+    for (int i = 0; i < 4000; ++i)
+    {
+        int key = random.bounded(200);
+        if (random.bounded(3) == 0)
+        {
+            tree.Insert(QString::number(key));
+            oracle.insert(key);
+        }
+        else if (random.bounded(8) == 0 && !oracle.empty())
+        {
+            QCOMPARE(std::get<qint16>(*tree.ExtractMax()), qint16(*oracle.rbegin()));
+            oracle.erase(std::prev(oracle.end()));
+        }
+        else
+        {
+            auto it = oracle.find(key);
+            QCOMPARE(tree.Delete(qint16(key)), it != oracle.end());
+            if (it != oracle.end())
+                oracle.erase(it);
+        }
+
+        QCOMPARE(tree.Find(QString::number(key)), oracle.count(key) > 0);
+        QCOMPARE(tree.Find(qint16(key)), oracle.count(key) > 0);
+        QCOMPARE(tree.GetNodeCount(), quint64(oracle.size()));
+        QCOMPARE(tree.GetRoot()->size, quint64(oracle.size()));
+        QVERIFY(tree.GetTombstoneCount() * 2 <= tree.GetNodeCount() + tree.GetTombstoneCount());
+    }
+
+    // Tombstones keep their node until the next compaction.
+    QCOMPARE(quint64(tree.GetPoolStatistics().liveNodes), tree.GetNodeCount() + tree.GetTombstoneCount());
+
+    std::vector<int> keys;
+    for (const Node& node : tree)
+        keys.push_back(std::get<qint16>(node.data));
+    QVERIFY(std::equal(keys.begin(), keys.end(), oracle.begin(), oracle.end()));
+    QCOMPARE(std::get<qint16>(tree.Min()->data), qint16(*oracle.begin()));
+    QCOMPARE(std::get<qint16>(tree.Max()->data), qint16(*oracle.rbegin()));
+
+    for (quint64 k = 0; k < keys.size(); k += 7)
+        QCOMPARE(std::get<qint16>(tree.Select(k)->data), qint16(keys[k]));
+    QCOMPARE(tree.Rank("100"), quint64(std::distance(oracle.begin(), oracle.lower_bound(100))));
+    QCOMPARE(tree.RangeAggregate("20", "120"),
+             qint64(std::accumulate(oracle.lower_bound(20), oracle.upper_bound(120), 0)));
+
+    // Compacting leaves the same keys in a fully linked, valid tree.
+    tree.Compact();
+    QCOMPARE(tree.GetTombstoneCount(), quint64(0));
+    QCOMPARE(quint64(tree.GetPoolStatistics().liveNodes), tree.GetNodeCount());
+    QCOMPARE(tree.GetHashIndexStatistics().entries, std::set<int>(oracle.begin(), oracle.end()).size());
+    keys.clear();
+    for (const Node& node : tree)
+        keys.push_back(std::get<qint16>(node.data));
+    QVERIFY(std::equal(keys.begin(), keys.end(), oracle.begin(), oracle.end()));
+
+    // Turning the mode off drops the remaining tombstones.
+    QVERIFY(tree.Delete(qint16(keys.front())));
+    QCOMPARE(tree.GetTombstoneCount(), quint64(1));
+    tree.SetLazyDelete(false);
+    QCOMPARE(tree.GetTombstoneCount(), quint64(0));
+    QCOMPARE(quint64(tree.GetPoolStatistics().liveNodes), tree.GetNodeCount());
+
+    // Multisets and maps revive the tombstone of a key inserted again.
+    RedBlackTree multiset;
+    multiset.SetMultiset(true);
+    multiset.SetLazyDelete(true, 0.9);
+    const Node* node = multiset.Insert("5").node;
+    multiset.Insert("7");
+    QVERIFY(multiset.Delete("5"));
+    QCOMPARE(multiset.Count("5"), quint64(0));
+    QCOMPARE(multiset.Insert("5").node, node);
+    QCOMPARE(multiset.Count("5"), quint64(1));
+    QCOMPARE(multiset.GetTombstoneCount(), quint64(0));
+
+    RedBlackMap map;
+    map.SetLazyDelete(true, 0.9);
+    map.InsertOrAssign("1", 10);
+    map.InsertOrAssign("2", 20);
+    QVERIFY(map.Delete("1"));
+    QVERIFY(map.FindValue("1") == nullptr);
+    auto [value, isInserted] = map.TryEmplace("1", 11);
+    QVERIFY(isInserted && value->toInt() == 11);
+
+    // A tombstone no longer overlaps anything.
+    RedBlackTree intervals;
+    intervals.SetTreeDataType(DataType::INTERVAL);
+    intervals.SetLazyDelete(true, 0.9);
+    intervals.Insert("[0,100]");
+    intervals.Insert("[10,20]");
+    intervals.Insert("[30,40]");
+    QVERIFY(intervals.Delete("[0,100]"));
+    QCOMPARE(intervals.Stab("50").size(), 0);
+    QCOMPARE(intervals.FindOverlap("[35,60]")->GetDataString(), QString("[30,40]"));
+    QCOMPARE(intervals.FindAllOverlaps("[0,50]").size(), 2);
+}
+
+void TestRedBlackTree::TestRelaxedBalance()
+{
+    RedBlackTree tree;
+    tree.SetTreeDataType(DataType::NUMBER);
+    tree.SetAggregate(Aggregate::Sum());
+    tree.SetRelaxedBalance(true);
+
+    // Sorted keys without fixups end up as one long red run.
+    for (int i = 0; i < 100; ++i)
+        tree.Insert(QString::number(i));
+
+    auto report = tree.CheckBalance();
+    QVERIFY(!report.IsValid());
+    QVERIFY(report.isBlackBalanced && !report.isRootBlack);
+    QCOMPARE(report.redViolations, quint64(99));
+    QCOMPARE(report.longestRedRun, quint32(100));
+    QCOMPARE(report.height, quint32(100));
+    QVERIFY(report.height > report.heightBound);
+    QCOMPARE(report.pendingFixups, quint64(100));
+    QVERIFY(tree.Find("57") && !tree.Find("100"));
+    QCOMPARE(tree.Rank("57"), quint64(57));
+
+    tree.Rebalance();
+    report = tree.CheckBalance();
+    QVERIFY(report.IsValid());
+    QVERIFY(report.height <= report.heightBound);
+    QCOMPARE(report.pendingFixups, quint64(0));
+
+    // A few violations next to a large tree are repaired in place.
+    std::multiset<int> oracle;
+    for (int i = 0; i < 100; ++i)
+        oracle.insert(i);
+    QRandomGenerator random(5);
+    for (int round = 0; round < 40; ++round)
+    {
+        int count = round % 2 == 0 ? 10 : 400;
+        for (int i = 0; i < count; ++i)
+        {
+            int key = random.bounded(-3000, 3000);
+            tree.Insert(qint16(key));
+            oracle.insert(key);
+        }
+        // Runs of keys increasing by one stack up to the right.
+        for (int i = 0; i < 8; ++i)
+        {
+            tree.Insert(qint16(3000 + round * 8 + i));
+            oracle.insert(3000 + round * 8 + i);
+        }
+
+        QVERIFY(tree.CheckBalance().isBlackBalanced);
+        QCOMPARE(tree.Find(qint16(3000 + round * 8)), true);
+        QCOMPARE(tree.CountRange("-100", "100"), quint64(std::distance(oracle.lower_bound(-100), oracle.upper_bound(100))));
+
+        if (round % 4 == 3)
+        {
+            // Deletes repair the tree first, DeleteFixup needs a valid one.
+            int key = *std::next(oracle.begin(), random.bounded(int(oracle.size())));
+            QVERIFY(tree.Delete(qint16(key)));
+            oracle.erase(oracle.find(key));
+            QCOMPARE(tree.CheckBalance().pendingFixups, quint64(0));
+        }
+        else
+            tree.Rebalance();
+
+        report = tree.CheckBalance();
+        QVERIFY(report.IsValid());
+        QVERIFY(report.height <= report.heightBound);
+    }
+
+    std::vector<int> keys;
+    for (const Node& node : tree)
+        keys.push_back(std::get<qint16>(node.data));
+    QVERIFY(std::equal(keys.begin(), keys.end(), oracle.begin(), oracle.end()));
+    QCOMPARE(tree.GetNodeCount(), quint64(oracle.size()));
+    QCOMPARE(tree.GetRoot()->aggregate, qint64(std::accumulate(oracle.begin(), oracle.end(), 0)));
+
+    // Turning the mode off repairs what is still queued.
+    tree.Insert("-5000");
+    tree.Insert("-4999");
+    QCOMPARE(tree.CheckBalance().pendingFixups, quint64(2));
+    tree.SetRelaxedBalance(false);
+    QVERIFY(tree.CheckBalance().IsValid() && tree.CheckBalance().pendingFixups == 0);
+}
+
+void TestRedBlackTree::BenchmarkUnion()
+{
+    QStringList evens, odds;
+    for (int i = -9998; i < 9998; i += 2)
+    {
+        evens.append(QString::number(i));
+        odds.append(QString::number(i + 1));
+    }
+
+    RedBlackTree first, second;
+    first.SetTreeDataType(DataType::NUMBER);
+    second.SetTreeDataType(DataType::NUMBER);
+    QVERIFY(first.BuildFromSorted(evens));
+    QVERIFY(second.BuildFromSorted(odds));
+
+    QBENCHMARK_ONCE
+    {
+        first.Union(second);
+    }
+    QCOMPARE(first.GetNodeCount(), quint64(19996));
+}
+
+void TestRedBlackTree::BenchmarkNaiveUnion()
+{
+    QStringList evens, odds;
+    for (int i = -9998; i < 9998; i += 2)
+    {
+        evens.append(QString::number(i));
+        odds.append(QString::number(i + 1));
+    }
+
+    RedBlackTree first;
+    first.SetTreeDataType(DataType::NUMBER);
+    QVERIFY(first.BuildFromSorted(evens));
+
+    QBENCHMARK_ONCE
+    {
+        for (const QString& key : odds)
+        {
+            if (!first.Find(key))
+                first.Insert(key);
+        }
+    }
+    QCOMPARE(first.GetNodeCount(), quint64(19996));
+}
+
 QTEST_MAIN(TestRedBlackTree)
 #include "testredblacktree.moc"
@@ -0,0 +1,46 @@
+#include "tracebuffer.h"
+#include <QFile>
+#include <QDataStream>
+
+TraceBuffer::TraceBuffer(std::size_t capacity)
+{
+    std::size_t size = 1;
+    while (size < capacity)
+        size *= 2;
+
+    events.resize(size);
+    mask = size - 1;
+}
+
+std::size_t TraceBuffer::Drain(std::vector<TraceEvent>& out)
+{
+    std::size_t count = Size();
+    out.reserve(out.size() + count);
+
+    for (; tail != head; ++tail)
+        out.push_back(events[tail & mask]);
+
+    return count;
+}
+
+void TraceBuffer::Clear()
+{
+    tail = head;
+}
+
+bool TraceBuffer::Dump(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream out(&file);
+    for (; tail != head; ++tail)
+    {
+        const TraceEvent& event = events[tail & mask];
+        out << quint8(event.op) << event.flags << event.value
+            << quint64(event.node) << quint64(event.other);
+    }
+
+    return true;
+}
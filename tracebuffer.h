@@ -0,0 +1,119 @@
+#ifndef TRACEBUFFER_H
+#define TRACEBUFFER_H
+
+#include <QColor>
+#include <vector>
+#include "node.h"
+
+// One step of a tree operation. Nodes are identified by their address, which stays
+// valid until the node is deleted, so a consumer can map them the way the visualizer
+// maps nodes to TreeNodes.
+enum class TraceOp : quint8
+{
+    UpdateHeight, UpdateNodeCount,
+    HighlightNode, ChangeColor, CreateNode, MoveNode,
+    MoveY, MoveX, MoveStart, ChangeParent,
+    LeftRotate, RightRotate,
+    Transplant, ChangeSibling, Delete
+};
+
+struct TraceEvent
+{
+    TraceOp op;
+    quint8 flags;       // the bool arguments of the step, first one in bit 0
+    quint32 value;      // Color of ChangeColor, QRgb of HighlightNode
+    quintptr node;
+    quintptr other;
+};
+
+// Fixed capacity ring buffer of TraceEvents. When it is full the oldest events are
+// overwritten and counted as dropped, so recording never allocates.
+//
+// The recorders are named after the RedBlackTree signals they mirror, RBT_EMIT calls
+// them with the signal arguments. The key text of HighlightNode is not recorded.
+class TraceBuffer
+{
+public:
+    static constexpr std::size_t DEFAULT_CAPACITY = 4096;
+
+    // The capacity is rounded up to a power of two.
+    explicit TraceBuffer(std::size_t capacity = DEFAULT_CAPACITY);
+
+    void Push(const TraceEvent& event)
+    {
+        events[head & mask] = event;
+        ++head;
+        if (head - tail > events.size())
+        {
+            ++tail;
+            ++dropped;
+        }
+    }
+
+    std::size_t Size() const { return head - tail; }
+    std::size_t Capacity() const { return events.size(); }
+    quint64 Dropped() const { return dropped; }
+
+    // Appends the buffered events to out, oldest first, and empties the buffer.
+    std::size_t Drain(std::vector<TraceEvent>& out);
+    void Clear();
+
+    // Drains the buffer into a binary file, one fixed-width record per event.
+    bool Dump(const QString& fileName);
+
+    void UpdateHeightSignal() { Push({ TraceOp::UpdateHeight, 0, 0, 0, 0 }); }
+    void UpdateNodeCountSignal() { Push({ TraceOp::UpdateNodeCount, 0, 0, 0, 0 }); }
+
+    void HighlightNodeSignal(Node* x, QColor color, bool isLeft = true, const QString& = "")
+    {
+        Push({ TraceOp::HighlightNode, Flags(isLeft), color.rgb(), Id(x), 0 });
+    }
+    void ChangeColorSignal(Node* node, Color color)
+    {
+        Push({ TraceOp::ChangeColor, 0, quint32(color), Id(node), 0 });
+    }
+    void CreateNodeSignal(Node* node) { Push({ TraceOp::CreateNode, 0, 0, Id(node), 0 }); }
+    void MoveNodeSignal(Node* node, Node* to, bool leftChild, bool isRoot = false)
+    {
+        Push({ TraceOp::MoveNode, Flags(leftChild, isRoot), 0, Id(node), Id(to) });
+    }
+
+    void MoveYSignal(Node* node, Node* to, bool leftChild, bool isLeftRotate, bool isRoot = false)
+    {
+        Push({ TraceOp::MoveY, Flags(leftChild, isLeftRotate, isRoot), 0, Id(node), Id(to) });
+    }
+    void MoveXSignal(Node* node, Node* to, bool leftChild)
+    {
+        Push({ TraceOp::MoveX, Flags(leftChild), 0, Id(node), Id(to) });
+    }
+    void MoveStartSignal(Node* x, Node* y, bool x_leftChild, bool y_leftChild)
+    {
+        Push({ TraceOp::MoveStart, Flags(x_leftChild, y_leftChild), 0, Id(x), Id(y) });
+    }
+    void ChangeParentSignal(Node* x, Node* y) { Push({ TraceOp::ChangeParent, 0, 0, Id(x), Id(y) }); }
+
+    void LeftRotateSignal(Node* x) { Push({ TraceOp::LeftRotate, 0, 0, Id(x), 0 }); }
+    void RightRotateSignal(Node* x) { Push({ TraceOp::RightRotate, 0, 0, Id(x), 0 }); }
+
+    void TransplantSignal(Node* node, Node* to, bool leftChild, bool isRoot = false)
+    {
+        Push({ TraceOp::Transplant, Flags(leftChild, isRoot), 0, Id(node), Id(to) });
+    }
+    void ChangeSiblingSignal(Node* node, Node* to, bool leftChild)
+    {
+        Push({ TraceOp::ChangeSibling, Flags(leftChild), 0, Id(node), Id(to) });
+    }
+    void DeleteSignal(Node* node) { Push({ TraceOp::Delete, 0, 0, Id(node), 0 }); }
+
+private:
+    static quintptr Id(const Node* node) { return reinterpret_cast<quintptr>(node); }
+    static quint8 Flags(bool a, bool b = false, bool c = false) { return quint8(a | b << 1 | c << 2); }
+
+    std::vector<TraceEvent> events;
+    std::size_t mask;
+    std::size_t head = 0;
+    std::size_t tail = 0;
+    quint64 dropped = 0;
+};
+
+#endif // TRACEBUFFER_H